@@ -0,0 +1,103 @@
+// Feature extraction benchmark: records the parse states along the gold transitions of a corpus, and then fills
+// the features of every state by walking the tree of feature combiners, by running the compiled program, and
+// with the extractor generated for the template if the build has one (HANSTHOLM_SPECIALIZED_TEMPLATE).
+//
+// Usage: hanstholm_bench_extract TEMPLATE_FILE INPUT_FILE
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "feature_set_parser.h"
+#include "input.h"
+
+
+struct RecordedState {
+    size_t sentence_index;
+    state_location_t locations;
+};
+
+// Follows the gold transitions of each sentence, or the first allowed move where the oracle has none
+std::vector<RecordedState> record_states(const std::vector<Sentence> &sentences, size_t num_labels) {
+    ArcEager strategy;
+    auto moves = strategy.moves(num_labels);
+    std::vector<RecordedState> states;
+    for (size_t sent_i = 0; sent_i < sentences.size(); sent_i++) {
+        auto &sent = sentences[sent_i];
+        auto state = ParseState(sent);
+        while (!state.is_terminal()) {
+            states.push_back({sent_i, state.locations_});
+            auto oracle_moves = strategy.oracle(state, sent);
+            auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
+            auto move = std::find_if(moves.begin(), moves.end(),
+                                     [&](const LabeledMove &move) { return oracle_moves.test(move); });
+            if (move == moves.end())
+                move = std::find_if(moves.begin(), moves.end(),
+                                    [&](const LabeledMove &move) { return allowed_moves.test(move); });
+            perform_move(*move, state, sent.tokens);
+        }
+    }
+    return states;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " TEMPLATE_FILE INPUT_FILE\n";
+        return 1;
+    }
+
+    try {
+        CorpusDictionary dict;
+        auto feature_set = read_feature_file(argv[1], dict);
+        auto sentences = VwSentenceReader(argv[2], dict).read();
+        auto states = record_states(sentences, dict.label_to_id.size());
+        std::cout << states.size() << " states in " << sentences.size() << " sentences, "
+                  << feature_set->operands.size() << " templates compiled into "
+                  << feature_set->program.instructions.size() << " instructions on "
+                  << feature_set->program.operands.size() << " operands\n";
+
+        // Only the locations are used by feature extraction
+        auto state = ParseState(2);
+        std::vector<FeatureKey> features;
+        FeatureProgramScratch scratch;
+        const char *extractor_names[] = {"tree:       ", "program:    ", "specialized:"};
+        int num_extractors = feature_set->specialized != nullptr ? 3 : 2;
+        size_t checksums[3] = {0, 0, 0};
+        for (int extractor = 0; extractor < num_extractors; extractor++) {
+            for (int run = 0; run < 3; run++) {
+                size_t checksum = 0;
+                size_t num_features = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (auto &recorded : states) {
+                    state.locations_ = recorded.locations;
+                    auto &sent = sentences[recorded.sentence_index];
+                    features.clear();
+                    if (extractor == 0)
+                        feature_set->fill_features(state, sent, features, 0);
+                    else if (extractor == 1)
+                        feature_set->program.fill_features(state, sent, features, scratch);
+                    else
+                        feature_set->specialized(feature_set->program.operands.data(), state, sent, features, scratch);
+                    for (auto &feature : features)
+                        checksum = checksum * 31 + feature.hashed_val;
+                    num_features += features.size();
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                checksums[extractor] = checksum;
+
+                std::cout << extractor_names[extractor] << " " << num_features << " features in "
+                          << seconds << " s (" << seconds * 1e9 / states.size() << " ns per state)\n";
+            }
+        }
+
+        if (checksums[0] != checksums[1] || (num_extractors == 3 && checksums[0] != checksums[2])) {
+            std::cerr << "error: the extractors disagree\n";
+            return 1;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Input reading benchmark: reads a file in the VW input format with `VwSentenceReader`
+// and reports the throughput and the peak resident set size.
+//
+// Usage: hanstholm_bench_read INPUT_FILE [THREADS]
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+
+#include "input.h"
+
+
+// Peak resident set size of the process as reported by the kernel, e.g. "123456 kB"
+std::string peak_rss() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return line.substr(line.find_first_not_of(" \t", 6));
+    }
+    return "unknown";
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " INPUT_FILE [THREADS]\n";
+        return 1;
+    }
+
+    struct stat file_stat;
+    if (stat(argv[1], &file_stat) != 0) {
+        std::cerr << "File " << argv[1] << " cannot be read\n";
+        return 1;
+    }
+    double megabytes = file_stat.st_size / double(1 << 20);
+
+    try {
+        size_t num_threads = argc > 2 ? std::stoul(argv[2]) : 1;
+        for (int run = 0; run < 3; run++) {
+            CorpusDictionary dict;
+            auto start = std::chrono::steady_clock::now();
+            auto sentences = VwSentenceReader(argv[1], dict).read(num_threads);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << sentences.size() << " sentences, " << dict.attribute_to_id.size() << " attributes in "
+                      << seconds << " s (" << megabytes / seconds << " MB/s)\n";
+        }
+        std::cout << "Peak RSS: " << peak_rss() << "\n";
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Per-state scoring benchmark: looks up the weight rows of a state's features
+// in a frozen table and accumulates them into the score vector with each kernel.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "hashtable_block.h"
+#include "score_kernel.h"
+
+
+int main() {
+    const size_t num_keys = 200000;
+    const size_t features_per_state = 30;
+    const size_t num_states = 200000;
+    std::mt19937 gen(1);
+
+    for (size_t num_labels : {10, 40, 80}) {
+        // SHIFT, REDUCE, and a LEFT-ARC and RIGHT-ARC per label
+        size_t num_moves = 2 + 2 * num_labels;
+        size_t row_size = padded_row_size(num_moves);
+
+        std::uniform_real_distribution<float> weight_dist(-1, 1);
+        std::vector<size_t> keys;
+        std::vector<float> values;
+        for (size_t i = 0; i < num_keys; i++) {
+            keys.push_back(i * 2 + 1);
+            for (size_t j = 0; j < row_size; j++)
+                values.push_back(j < num_moves ? weight_dist(gen) : 0);
+        }
+        auto table = StaticHashTableBlock(keys, values, row_size);
+
+        // Roughly a quarter of the features are unseen, and some carry non-unit values
+        std::uniform_int_distribution<size_t> key_dist(1, num_keys * 2 + num_keys / 2);
+        std::bernoulli_distribution weighted_dist(0.2);
+        std::vector<size_t> feature_keys(features_per_state * num_states);
+        std::vector<float> feature_values(feature_keys.size());
+        for (size_t i = 0; i < feature_keys.size(); i++) {
+            feature_keys[i] = key_dist(gen);
+            feature_values[i] = weighted_dist(gen) ? 0.7f : 1.0f;
+        }
+
+        std::cout << num_labels << " labels (" << num_moves << " moves, rows of " << row_size << ")\n";
+        aligned_vector<float> scores(row_size);
+        double scalar_ns = 0;
+        for (auto name : {"scalar", "sse", "avx2"}) {
+            auto kernel = accumulate_row_kernel(name);
+            if (kernel == nullptr) {
+                std::cout << "  " << name << ": not supported\n";
+                continue;
+            }
+
+            float checksum = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t state_i = 0; state_i < num_states; state_i++) {
+                std::fill(scores.begin(), scores.end(), 0);
+                for (size_t f = state_i * features_per_state; f < (state_i + 1) * features_per_state; f++) {
+                    const float *row = table.lookup(feature_keys[f]);
+                    if (row != nullptr)
+                        kernel(scores.data(), row, row_size, feature_values[f]);
+                }
+                checksum += scores[state_i % num_moves];
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            double ns_per_state = std::chrono::duration<double, std::nano>(elapsed).count() / num_states;
+            if (scalar_ns == 0)
+                scalar_ns = ns_per_state;
+
+            std::cout << "  " << name << ": " << ns_per_state << " ns/state, speedup "
+                      << scalar_ns / ns_per_state << "x (checksum " << checksum << ")\n";
+        }
+    }
+
+    return 0;
+}
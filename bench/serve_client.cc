@@ -0,0 +1,135 @@
+// Test client for `hanstholm serve --socket PATH`. Sends every sentence of a file in the VW input format
+// over the socket without waiting for answers, and reports throughput and the latency of each sentence
+// from the moment it was sent until its answer arrived.
+//
+// Usage: hanstholm_serve_client SOCKET INPUT_FILE [REPEAT]
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using clock_type = std::chrono::steady_clock;
+
+
+std::vector<std::string> read_sentences(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in.good())
+        throw std::runtime_error("File " + filename + " cannot be read");
+
+    std::vector<std::string> sentences;
+    std::string line, sentence;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            if (!sentence.empty())
+                sentences.push_back(sentence + "\n");
+            sentence.clear();
+        } else {
+            sentence += line + "\n";
+        }
+    }
+    if (!sentence.empty())
+        sentences.push_back(sentence + "\n");
+    return sentences;
+}
+
+int connect_to(const std::string &path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        throw std::runtime_error("Could not connect to " + path + ": " + strerror(errno));
+    return fd;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " SOCKET INPUT_FILE [REPEAT]\n";
+        return 1;
+    }
+
+    try {
+        auto sentences = read_sentences(argv[2]);
+        size_t repeat = argc > 3 ? std::stoul(argv[3]) : 1;
+        size_t num_requests = sentences.size() * repeat;
+        int fd = connect_to(argv[1]);
+
+        std::vector<clock_type::time_point> sent_at(num_requests);
+        auto start = clock_type::now();
+
+        std::thread sender([&]() {
+            for (size_t i = 0; i < num_requests; i++) {
+                const auto &sentence = sentences[i % sentences.size()];
+                sent_at[i] = clock_type::now();
+                size_t num_written = 0;
+                while (num_written < sentence.size()) {
+                    ssize_t result = write(fd, sentence.data() + num_written, sentence.size() - num_written);
+                    if (result <= 0)
+                        return;
+                    num_written += result;
+                }
+            }
+            // No more sentences. The server answers the rest and closes the connection.
+            shutdown(fd, SHUT_WR);
+        });
+
+        // An answer ends with an empty line
+        std::vector<double> latencies;
+        size_t num_errors = 0;
+        std::vector<char> buffer(1 << 16);
+        bool answer_is_error = false;
+        size_t line_length = 0;
+        ssize_t num_read;
+        while (latencies.size() < num_requests && (num_read = read(fd, buffer.data(), buffer.size())) > 0) {
+            for (ssize_t i = 0; i < num_read; i++) {
+                char c = buffer[i];
+                if (line_length == 0 && c == '#')
+                    answer_is_error = true;
+                if (c == '\n') {
+                    if (line_length == 0) {
+                        auto latency = clock_type::now() - sent_at[latencies.size()];
+                        latencies.push_back(std::chrono::duration<double, std::micro>(latency).count());
+                        num_errors += answer_is_error;
+                        answer_is_error = false;
+                    }
+                    line_length = 0;
+                } else {
+                    line_length++;
+                }
+            }
+        }
+        double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+        sender.join();
+        close(fd);
+
+        if (latencies.size() < num_requests)
+            std::cerr << "Connection closed after " << latencies.size() << " of " << num_requests << " answers\n";
+        if (latencies.empty())
+            return 1;
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double fraction) {
+            return latencies[std::min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()))];
+        };
+        std::cout << latencies.size() << " sentences in " << seconds << " s ("
+                  << latencies.size() / seconds << " sentences/s), " << num_errors << " errors\n";
+        std::cout << "Latency (us): p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+                  << ", p99 " << percentile(0.99) << ", max " << latencies.back() << "\n";
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
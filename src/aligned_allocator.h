@@ -0,0 +1,47 @@
+#ifndef HANSTHOLM_ALIGNED_ALLOCATOR_H
+#define HANSTHOLM_ALIGNED_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+/**
+ * Allocator returning memory aligned to `Alignment` bytes, so that vector data can be used with aligned SIMD loads.
+ */
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) { }
+
+    T *allocate(size_t n) {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t) {
+        free(ptr);
+    }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) { return true; }
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) { return false; }
+
+// Cache line alignment also satisfies every SIMD width in use
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T, 64>>;
+
+#endif //HANSTHOLM_ALIGNED_ALLOCATOR_H
@@ -0,0 +1,43 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+
+namespace {
+    std::atomic<size_t> num_allocations(0);
+}
+
+void *operator new(size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    void *memory = std::malloc(size > 0 ? size : 1);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+bool heap_allocations_counted() {
+    return true;
+}
+
+size_t heap_allocation_count() {
+    return num_allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool heap_allocations_counted() {
+    return false;
+}
+
+size_t heap_allocation_count() {
+    return 0;
+}
+
+#endif
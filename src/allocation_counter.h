@@ -0,0 +1,15 @@
+#ifndef HANSTHOLM_ALLOCATION_COUNTER_H
+#define HANSTHOLM_ALLOCATION_COUNTER_H
+
+#include <cstddef>
+
+// Counts the heap allocations made through `operator new` by all threads, in builds without NDEBUG. This is for
+// checking that loops which should not allocate do not. Linking this file replaces the global `operator new`.
+
+// Whether allocations are counted in this build
+bool heap_allocations_counted();
+
+// The number of allocations so far. Always 0 if allocations are not counted.
+size_t heap_allocation_count();
+
+#endif //HANSTHOLM_ALLOCATION_COUNTER_H
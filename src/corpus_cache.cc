@@ -0,0 +1,371 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "corpus_cache.h"
+#include "input.h"
+#include "mapped_file.h"
+#include "hash.h"
+#include "varint.h"
+
+namespace {
+
+const char corpus_cache_magic[8] = {'H', 'N', 'S', 'T', 'C', 'R', 'P', 'S'};
+const uint32_t corpus_cache_version = 1;
+
+// Written to the file in chunks of this size
+const size_t write_chunk_size = 1 << 20;
+
+struct SourceInfo {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t content_hash = 0;
+};
+
+uint64_t hash_content(const char *data, size_t size) {
+    uint64_t hash = size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = integerHash(hash ^ word);
+    }
+    uint64_t rest = 0;
+    if (i < size)
+        memcpy(&rest, data + i, size - i);
+    return integerHash(hash ^ rest);
+}
+
+// Size and modification time, without the content hash
+SourceInfo stat_source(const std::string &source_file) {
+    struct stat file_stat;
+    if (stat(source_file.c_str(), &file_stat) != 0)
+        throw std::runtime_error("File " + source_file + " cannot be read");
+
+    SourceInfo info;
+    info.size = static_cast<uint64_t>(file_stat.st_size);
+    info.mtime_ns = static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    return info;
+}
+
+uint64_t hash_source(const std::string &source_file) {
+    MappedFile source(source_file);
+    return hash_content(source.data(), source.size());
+}
+
+
+template <typename T>
+void put_raw(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void put_string(std::string &out, const std::string &value) {
+    put_varint(out, value.size());
+    out.append(value);
+}
+
+template <typename T>
+void put_keys(std::string &out, const std::unordered_map<std::string, T> &map) {
+    std::vector<const std::string *> keys(map.size());
+    for (auto &kv_pair : map)
+        keys[kv_pair.second] = &kv_pair.first;
+
+    put_varint(out, keys.size());
+    for (auto key : keys)
+        put_string(out, *key);
+}
+
+void put_sentence(std::string &out, const Sentence &sentence) {
+    // The identifiers are stored together in front of the tokens, in token order
+    uint64_t text_length = 0;
+    for (auto &token : sentence.tokens)
+        text_length += token.id.length;
+    put_varint(out, text_length);
+    for (auto &token : sentence.tokens)
+        out.append(sentence.text.get() + token.id.offset, token.id.length);
+
+    put_varint(out, sentence.tokens.size());
+    for (auto &token : sentence.tokens) {
+        put_varint(out, zigzag_encode(token.head));
+        put_varint(out, token.label);
+        put_varint(out, token.id.length);
+        put_varint(out, token.namespaces_end - token.namespaces_begin);
+        for (auto ns_i = token.namespaces_begin; ns_i < token.namespaces_end; ns_i++) {
+            auto &ns = sentence.namespaces[ns_i];
+            put_varint(out, ns.index);
+            put_varint(out, zigzag_encode(ns.token_specific_ns));
+            put_varint(out, ns.attributes_end - ns.attributes_begin);
+            auto attributes = sentence.namespace_attributes(ns);
+            for (auto attribute = attributes.first; attribute != attributes.second; attribute++) {
+                // Values other than 1 follow the index
+                bool has_value = attribute->value != 1;
+                put_varint(out, static_cast<uint64_t>(attribute->index) << 1 | has_value);
+                if (has_value)
+                    put_raw(out, attribute->value);
+            }
+        }
+    }
+
+    put_varint(out, sentence.arc_constraints.size());
+    for (auto &constraint : sentence.arc_constraints) {
+        put_varint(out, zigzag_encode(constraint.head));
+        put_varint(out, zigzag_encode(constraint.dep));
+        put_varint(out, zigzag_encode(constraint.label));
+    }
+    put_varint(out, sentence.span_constraints.size());
+    for (auto &constraint : sentence.span_constraints) {
+        put_varint(out, zigzag_encode(constraint.span_start));
+        put_varint(out, zigzag_encode(constraint.span_end));
+        out.push_back(constraint.permit_root_deps);
+    }
+}
+
+
+// Decodes the cache file, throwing on anything that does not add up
+class CacheDecoder {
+public:
+    CacheDecoder(const std::string &cache_file, const char *begin, const char *end)
+            : cache_file(cache_file), pos(begin), end(end) { }
+
+    uint64_t varint() {
+        uint64_t value;
+        if (!decode_varint(pos, end, value))
+            corrupt();
+        return value;
+    }
+
+    // A varint that counts items of at least `min_item_size` bytes each
+    size_t count(size_t min_item_size = 1) {
+        uint64_t value = varint();
+        if (value > static_cast<uint64_t>(end - pos) / min_item_size)
+            corrupt();
+        return static_cast<size_t>(value);
+    }
+
+    int64_t signed_varint() {
+        return zigzag_decode(varint());
+    }
+
+    const char *bytes(size_t size) {
+        if (static_cast<size_t>(end - pos) < size)
+            corrupt();
+        const char *begin = pos;
+        pos += size;
+        return begin;
+    }
+
+    template <typename T>
+    T raw() {
+        T value;
+        memcpy(&value, bytes(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void keys(std::unordered_map<std::string, T> &map) {
+        size_t num_keys = count();
+        std::string key;
+        for (size_t i = 0; i < num_keys; i++) {
+            size_t length = count();
+            key.assign(bytes(length), length);
+            if (!map.emplace(key, static_cast<T>(i)).second)
+                corrupt();
+        }
+    }
+
+    void sentence(Sentence &sentence, const std::shared_ptr<MappedFile> &mapping, const CorpusDictionary &dictionary) {
+        size_t text_length = count();
+        const char *text = bytes(text_length);
+        sentence.text = std::shared_ptr<const char>(mapping, text);
+
+        uint32_t text_offset = 0;
+        sentence.tokens.resize(count());
+        for (size_t token_i = 0; token_i < sentence.tokens.size(); token_i++) {
+            auto &token = sentence.tokens[token_i];
+            token.index = static_cast<token_index_t>(token_i);
+            token.head = static_cast<token_index_t>(signed_varint());
+            token.label = static_cast<label_type_t>(id(dictionary.label_to_id.size()));
+            token.id.offset = text_offset;
+            token.id.length = static_cast<uint32_t>(varint());
+            text_offset += token.id.length;
+            if (text_offset > text_length)
+                corrupt();
+
+            size_t num_namespaces = count();
+            token.namespaces_begin = static_cast<uint32_t>(sentence.namespaces.size());
+            for (size_t ns_i = 0; ns_i < num_namespaces; ns_i++) {
+                sentence.namespaces.emplace_back();
+                auto &ns = sentence.namespaces.back();
+                ns.index = static_cast<namespace_t>(id(dictionary.namespace_to_id.size()));
+                ns.token_specific_ns = static_cast<namespace_t>(signed_varint());
+                size_t num_attributes = count();
+                ns.attributes_begin = static_cast<uint32_t>(sentence.attributes.size());
+                for (size_t i = 0; i < num_attributes; i++) {
+                    uint64_t encoded = varint();
+                    weight_t value = (encoded & 1) ? raw<weight_t>() : 1;
+                    sentence.attributes.emplace_back(
+                            static_cast<attribute_t>(id(dictionary.attribute_to_id.size(), encoded >> 1)), value);
+                }
+                ns.attributes_end = static_cast<uint32_t>(sentence.attributes.size());
+            }
+            token.namespaces_end = static_cast<uint32_t>(sentence.namespaces.size());
+        }
+
+        sentence.arc_constraints.resize(count());
+        for (auto &constraint : sentence.arc_constraints) {
+            constraint.head = static_cast<token_index_t>(signed_varint());
+            constraint.dep = static_cast<token_index_t>(signed_varint());
+            constraint.label = static_cast<label_type_t>(signed_varint());
+        }
+        sentence.span_constraints.resize(count());
+        for (auto &constraint : sentence.span_constraints) {
+            constraint.span_start = static_cast<token_index_t>(signed_varint());
+            constraint.span_end = static_cast<token_index_t>(signed_varint());
+            constraint.permit_root_deps = raw<char>() != 0;
+        }
+
+        sentence.index_namespaces();
+        sentence.index_constraints();
+    }
+
+    bool at_end() const { return pos == end; }
+
+    [[noreturn]] void corrupt() {
+        throw std::runtime_error("Corpus cache " + cache_file + " is corrupt");
+    }
+
+private:
+    size_t id(size_t dictionary_size) {
+        return id(dictionary_size, varint());
+    }
+
+    size_t id(size_t dictionary_size, uint64_t value) {
+        if (value >= dictionary_size)
+            corrupt();
+        return static_cast<size_t>(value);
+    }
+
+    const std::string &cache_file;
+    const char *pos;
+    const char *end;
+};
+
+}
+
+
+void write_corpus_cache(const std::string &cache_file, const std::string &source_file,
+                        const std::vector<Sentence> &sentences, const CorpusDictionary &dictionary) {
+    auto source_info = stat_source(source_file);
+    source_info.content_hash = hash_source(source_file);
+
+    // Write to a temporary file first, so that an interrupted write does not leave a broken cache behind
+    std::string temp_file = cache_file + ".tmp";
+    std::ofstream out(temp_file, std::ios::binary | std::ios::trunc);
+    if (!out.good())
+        throw std::runtime_error("Could not open corpus cache " + temp_file + " for writing");
+
+    std::string buffer;
+    buffer.append(corpus_cache_magic, sizeof(corpus_cache_magic));
+    put_raw(buffer, corpus_cache_version);
+    put_raw(buffer, source_info.size);
+    put_raw(buffer, source_info.mtime_ns);
+    put_raw(buffer, source_info.content_hash);
+
+    put_keys(buffer, dictionary.label_to_id);
+    put_keys(buffer, dictionary.attribute_to_id);
+    put_keys(buffer, dictionary.namespace_to_id);
+
+    put_varint(buffer, sentences.size());
+    for (auto &sentence : sentences) {
+        put_sentence(buffer, sentence);
+        if (buffer.size() >= write_chunk_size) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    out.close();
+
+    if (!out.good() || std::rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+        std::remove(temp_file.c_str());
+        throw std::runtime_error("Could not write corpus cache " + cache_file);
+    }
+}
+
+bool read_corpus_cache(const std::string &cache_file, const std::string &source_file,
+                       std::vector<Sentence> &sentences, CorpusDictionary &dictionary) {
+    struct stat cache_stat;
+    if (stat(cache_file.c_str(), &cache_stat) != 0)
+        return false;
+
+    auto mapping = std::make_shared<MappedFile>(cache_file);
+    if (mapping->size() < sizeof(corpus_cache_magic) ||
+            memcmp(mapping->data(), corpus_cache_magic, sizeof(corpus_cache_magic)) != 0)
+        // Not ours to overwrite
+        throw std::invalid_argument("File " + cache_file + " exists, but is not a corpus cache");
+
+    CacheDecoder decoder(cache_file, mapping->data() + sizeof(corpus_cache_magic),
+                         mapping->data() + mapping->size());
+    if (decoder.raw<uint32_t>() != corpus_cache_version)
+        return false;
+
+    SourceInfo cached_info;
+    cached_info.size = decoder.raw<uint64_t>();
+    cached_info.mtime_ns = decoder.raw<int64_t>();
+    cached_info.content_hash = decoder.raw<uint64_t>();
+
+    // The content is only hashed if the file may have been touched without being changed
+    auto source_info = stat_source(source_file);
+    if (source_info.size != cached_info.size)
+        return false;
+    if (source_info.mtime_ns != cached_info.mtime_ns && hash_source(source_file) != cached_info.content_hash)
+        return false;
+
+    decoder.keys(dictionary.label_to_id);
+    decoder.keys(dictionary.attribute_to_id);
+    decoder.keys(dictionary.namespace_to_id);
+
+    sentences.resize(decoder.count());
+    for (auto &sentence : sentences)
+        decoder.sentence(sentence, mapping, dictionary);
+    if (!decoder.at_end())
+        decoder.corrupt();
+    return true;
+}
+
+std::vector<Sentence> read_with_corpus_cache(const std::string &source_file, const std::string &cache_file,
+                                             CorpusDictionary &dictionary, size_t num_threads) {
+    // The cache holds ids of a dictionary of the file alone. They are translated after loading or parsing.
+    CorpusDictionary file_dictionary;
+    std::vector<Sentence> sentences;
+
+    bool loaded = false;
+    try {
+        loaded = read_corpus_cache(cache_file, source_file, sentences, file_dictionary);
+    } catch (std::runtime_error &e) {
+        std::cerr << "Ignoring corpus cache: " << e.what() << "\n";
+        file_dictionary = CorpusDictionary();
+        sentences.clear();
+    }
+
+    if (loaded) {
+        std::cerr << "Corpus " << source_file << " loaded from cache " << cache_file << "\n";
+    } else {
+        sentences = VwSentenceReader(source_file, file_dictionary).read(num_threads);
+        try {
+            write_corpus_cache(cache_file, source_file, sentences, file_dictionary);
+            std::cerr << "Corpus " << source_file << " cached in " << cache_file << "\n";
+        } catch (std::runtime_error &e) {
+            std::cerr << "warning: " << e.what() << "\n";
+        }
+    }
+
+    auto id_map = dictionary.merge(file_dictionary);
+    for (auto &sentence : sentences)
+        id_map.apply(sentence);
+    return sentences;
+}
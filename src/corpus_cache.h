@@ -0,0 +1,31 @@
+#ifndef HANSTHOLM_CORPUS_CACHE_H
+#define HANSTHOLM_CORPUS_CACHE_H
+
+#include <string>
+#include <vector>
+#include "feature_handling.h"
+
+// Binary file holding a parsed corpus: the sentences with their ids, constraints and token identifiers, and the
+// dictionary entries they refer to. The ids are those of a dictionary built from the corpus file alone, so the
+// cache does not depend on what else has been read into a dictionary.
+//
+// The cache also records the size, modification time and a content hash of the file it was made from.
+// It is stale if the size differs, or if the modification time differs and so does the content.
+
+
+// Writes the sentences of `source_file`, read with the fresh dictionary `dictionary`, to `cache_file`
+void write_corpus_cache(const std::string &cache_file, const std::string &source_file,
+                        const std::vector<Sentence> &sentences, const CorpusDictionary &dictionary);
+
+// Loads a cache made from `source_file` into `sentences` and `dictionary`, which must be fresh. The token
+// identifiers point into the mapped cache file. Returns false if there is no cache or it is stale.
+bool read_corpus_cache(const std::string &cache_file, const std::string &source_file,
+                       std::vector<Sentence> &sentences, CorpusDictionary &dictionary);
+
+// Reads `source_file` into `dictionary` through a cache in `cache_file`. The cache is loaded if it is up to date,
+// and otherwise the file is parsed with `num_threads` threads and the cache is (re)written.
+// The sentences and dictionary ids are the same as with `VwSentenceReader::read`.
+std::vector<Sentence> read_with_corpus_cache(const std::string &source_file, const std::string &cache_file,
+                                             CorpusDictionary &dictionary, size_t num_threads);
+
+#endif //HANSTHOLM_CORPUS_CACHE_H
@@ -0,0 +1,190 @@
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "feature_cache.h"
+#include "varint.h"
+
+// Records are read in chunks of this size, and the kernel is asked to prefetch this much beyond the current chunk
+const size_t cache_read_chunk_size = 1 << 20;
+const size_t cache_readahead_size = 16 << 20;
+
+
+static uint64_t get_varint(const char *&pos, const char *end) {
+    uint64_t value;
+    if (!decode_varint(pos, end, value))
+        throw std::runtime_error("Corrupt feature cache record");
+    return value;
+}
+
+static void put_move_set(std::string &out, const LabeledMoveSet &moves) {
+    uint64_t mask = 0;
+    for (size_t move_i = 0; move_i < static_cast<size_t>(Move::COUNT); move_i++) {
+        if (moves.test(static_cast<Move>(move_i)))
+            mask |= 1 << move_i;
+    }
+    // The label is -1 when unrestricted
+    put_varint(out, (static_cast<uint64_t>(moves.label + 1) << static_cast<size_t>(Move::COUNT)) | mask);
+}
+
+static LabeledMoveSet get_move_set(const char *&pos, const char *end) {
+    uint64_t encoded = get_varint(pos, end);
+    LabeledMoveSet moves;
+    for (size_t move_i = 0; move_i < static_cast<size_t>(Move::COUNT); move_i++) {
+        if (encoded & (1 << move_i))
+            moves.set(static_cast<Move>(move_i));
+    }
+    moves.label = static_cast<label_type_t>(encoded >> static_cast<size_t>(Move::COUNT)) - 1;
+    return moves;
+}
+
+
+void encode_sentence_cache(const SentenceFeatureCache &cache, std::string &record) {
+    record.clear();
+    put_varint(record, cache.transitions.size());
+
+    size_t features_begin = 0;
+    for (const auto &transition : cache.transitions) {
+        put_varint(record, transition.gold_move_index);
+        put_move_set(record, transition.allowed_moves);
+        put_move_set(record, transition.oracle_moves);
+
+        size_t num_features = transition.features_end - features_begin;
+        put_varint(record, num_features);
+        size_t num_non_unit = 0;
+        for (size_t i = features_begin; i < transition.features_end; i++) {
+            record.append(reinterpret_cast<const char *>(&cache.features[i].hashed_val), sizeof(size_t));
+            num_non_unit += cache.features[i].value != 1;
+        }
+
+        put_varint(record, num_non_unit);
+        for (size_t i = features_begin; i < transition.features_end; i++) {
+            if (cache.features[i].value != 1) {
+                put_varint(record, i - features_begin);
+                record.append(reinterpret_cast<const char *>(&cache.features[i].value), sizeof(float));
+            }
+        }
+
+        features_begin = transition.features_end;
+    }
+}
+
+void decode_sentence_cache(const std::string &record, SentenceFeatureCache &cache) {
+    cache.clear();
+    const char *pos = record.data();
+    const char *end = pos + record.size();
+
+    size_t num_transitions = get_varint(pos, end);
+    cache.transitions.reserve(num_transitions);
+    for (size_t transition_i = 0; transition_i < num_transitions; transition_i++) {
+        size_t gold_move_index = get_varint(pos, end);
+        auto allowed_moves = get_move_set(pos, end);
+        auto oracle_moves = get_move_set(pos, end);
+
+        size_t num_features = get_varint(pos, end);
+        if (pos + num_features * sizeof(size_t) > end)
+            throw std::runtime_error("Corrupt feature cache record");
+        size_t features_begin = cache.features.size();
+        for (size_t i = 0; i < num_features; i++) {
+            FeatureKey feature;
+            memcpy(&feature.hashed_val, pos, sizeof(size_t));
+            pos += sizeof(size_t);
+            cache.features.push_back(feature);
+        }
+
+        size_t num_non_unit = get_varint(pos, end);
+        for (size_t i = 0; i < num_non_unit; i++) {
+            size_t index = get_varint(pos, end);
+            if (index >= num_features || pos + sizeof(float) > end)
+                throw std::runtime_error("Corrupt feature cache record");
+            memcpy(&cache.features[features_begin + index].value, pos, sizeof(float));
+            pos += sizeof(float);
+        }
+
+        cache.transitions.push_back({cache.features.size(), allowed_moves, oracle_moves, gold_move_index});
+    }
+}
+
+
+FeatureCacheWriter::FeatureCacheWriter(const std::string &filename)
+        : filename(filename), out(filename, std::ofstream::binary | std::ofstream::trunc) {
+    if (!out.good())
+        throw std::runtime_error("Could not open feature cache " + filename + " for writing");
+}
+
+void FeatureCacheWriter::write(const SentenceFeatureCache &cache) {
+    encode_sentence_cache(cache, record_buffer);
+    write_record(record_buffer);
+}
+
+void FeatureCacheWriter::write_record(const std::string &record) {
+    std::string size_prefix;
+    put_varint(size_prefix, record.size());
+    out.write(size_prefix.data(), size_prefix.size());
+    out.write(record.data(), record.size());
+    if (!out.good())
+        throw std::runtime_error("Failed writing feature cache " + filename);
+}
+
+
+FeatureCacheReader::FeatureCacheReader(const std::string &filename) : filename(filename) {
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("File " + filename + " cannot be read");
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    buffer.resize(cache_read_chunk_size);
+}
+
+FeatureCacheReader::~FeatureCacheReader() {
+    if (fd != -1)
+        close(fd);
+}
+
+bool FeatureCacheReader::fill(size_t min_available) {
+    // Move the unread bytes to the front of the buffer
+    if (buffer_pos > 0) {
+        memmove(buffer.data(), buffer.data() + buffer_pos, buffer_end - buffer_pos);
+        buffer_end -= buffer_pos;
+        buffer_pos = 0;
+    }
+    if (buffer.size() < min_available)
+        buffer.resize(min_available);
+
+    while (buffer_end < min_available) {
+        ssize_t num_read = read(fd, buffer.data() + buffer_end, buffer.size() - buffer_end);
+        if (num_read < 0)
+            throw std::runtime_error("Failed reading feature cache " + filename);
+        if (num_read == 0)
+            return false;
+        buffer_end += num_read;
+        file_offset += num_read;
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, file_offset, cache_readahead_size, POSIX_FADV_WILLNEED);
+#endif
+    }
+    return true;
+}
+
+bool FeatureCacheReader::next(std::string &record) {
+    // A size prefix is at most 10 bytes. Near the end of the file fewer may be available.
+    const size_t max_varint_size = 10;
+    if (buffer_end - buffer_pos < max_varint_size)
+        fill(max_varint_size);
+    if (buffer_pos == buffer_end)
+        return false;
+
+    const char *pos = buffer.data() + buffer_pos;
+    size_t record_size = get_varint(pos, buffer.data() + buffer_end);
+    buffer_pos = pos - buffer.data();
+
+    if (buffer_end - buffer_pos < record_size && !fill(record_size))
+        throw std::runtime_error("Truncated feature cache " + filename);
+
+    record.assign(buffer.data() + buffer_pos, record_size);
+    buffer_pos += record_size;
+    return true;
+}
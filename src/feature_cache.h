@@ -0,0 +1,78 @@
+#ifndef HANSTHOLM_FEATURE_CACHE_H
+#define HANSTHOLM_FEATURE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sys/types.h>
+#include "feature_handling.h"
+#include "features.h"
+
+// The transitions of one sentence along the gold trajectory, recorded during training.
+// Later passes replay them instead of extracting features and running the oracle again.
+struct CachedTransition {
+    // End offset of the transition's features in `SentenceFeatureCache::features`
+    size_t features_end;
+    LabeledMoveSet allowed_moves;
+    LabeledMoveSet oracle_moves;
+    // The gold move taken. The next recorded transition is only valid if the same move is taken again.
+    size_t gold_move_index;
+};
+
+struct SentenceFeatureCache {
+    std::vector<FeatureKey> features;
+    std::vector<CachedTransition> transitions;
+
+    void clear() {
+        features.clear();
+        transitions.clear();
+    }
+};
+
+// Compact binary encoding of a sentence recording, used by the cache file.
+// Counts, move indices and move sets are varints. Feature hashes are stored as raw 8-byte words:
+// they are uniformly distributed over 64 bits, so delta or varint coding would not shrink them.
+// Only feature values other than 1 are stored, as (varint index, float) pairs.
+void encode_sentence_cache(const SentenceFeatureCache &cache, std::string &record);
+void decode_sentence_cache(const std::string &record, SentenceFeatureCache &cache);
+
+
+/**
+ * Writes length-prefixed sentence records to a cache file.
+ */
+class FeatureCacheWriter {
+public:
+    FeatureCacheWriter(const std::string &filename);
+    void write(const SentenceFeatureCache &cache);
+    // Writes an already encoded record
+    void write_record(const std::string &record);
+private:
+    std::string filename;
+    std::ofstream out;
+    std::string record_buffer;
+};
+
+/**
+ * Reads the records of a cache file in order. The file is read in large chunks,
+ * and the kernel is asked to prefetch ahead of the current chunk.
+ */
+class FeatureCacheReader {
+public:
+    FeatureCacheReader(const std::string &filename);
+    ~FeatureCacheReader();
+    FeatureCacheReader(const FeatureCacheReader &) = delete;
+    FeatureCacheReader &operator=(const FeatureCacheReader &) = delete;
+
+    // Returns false at the end of the file
+    bool next(std::string &record);
+private:
+    bool fill(size_t min_available);
+    std::string filename;
+    int fd = -1;
+    std::vector<char> buffer;
+    size_t buffer_pos = 0;
+    size_t buffer_end = 0;
+    off_t file_offset = 0;
+};
+
+#endif //HANSTHOLM_FEATURE_CACHE_H
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <utility>
 #include "feature_handling.h"
 #include "feature_combiner.h"
+#include "specialized_extractor.h"
 
 
 std::pair<attribute_list_citerator, attribute_list_citerator> Location::find_attributes(const ParseState &state,
@@ -12,38 +14,20 @@ std::pair<attribute_list_citerator, attribute_list_citerator> Location::find_att
     // Except for the value -1, which means 'not found'.
     assert(token_index >= -1);
 
-    if (token_index >= 0) {
-        auto &token = sent.tokens[token_index];
-        auto &attributes = token.find_namespace(ns, token_specific_ns);
-        return std::make_pair(attributes.cbegin(), attributes.cend());
-    } else {
-        auto &first_token = sent.tokens[0];
-        return std::make_pair(first_token._empty_attribute_vector.cbegin(), first_token._empty_attribute_vector.cend());
-    }
+    if (token_index >= 0)
+        return sent.find_namespace(token_index, ns, token_specific_ns);
+    else
+        return attribute_range(nullptr, nullptr);
 }
 
 
 void Location::fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features,
                              size_t start_index) {
-    size_t initial_vector_size = features.size();
-    assert(initial_vector_size - start_index >= 1);
-
-    auto it_pair = find_attributes(state, sent);
-    if (it_pair.first != it_pair.second) {
-        // Loop over the existing features. We are guaranteed to have at least one feature.
-        for (size_t i = start_index; i < initial_vector_size; i++) {
-            // Skip the first attribute. We'll get back to it at the end of the loop.
-            auto it = std::next(it_pair.first);
-            for (; it != it_pair.second; it++) {
-                // Insert new features for the 1..n attributes in the namespace.
-                // These end up at indices beyond `initial_vector_size`, so we won't see them again in this loop.
-                features.push_back(features[i]);
-                features.back().add_attribute(*it);
-            }
-            // Now add the first attribute to the current feature.
-            features[i].add_attribute(*it_pair.first);
-        }
-    }
+    add_attributes(features, start_index, find_attributes(state, sent));
+}
+
+void Location::compile(FeatureProgram &program) const {
+    program.add_location(location, ns, token_specific_ns);
 }
 
 bool Location::good(const ParseState &state) const {
@@ -55,8 +39,6 @@ void CartesianProduct::fill_features(const ParseState &state, const Sentence &se
                                      size_t start_index) {
     lhs->fill_features(state, sent, features, start_index);
     rhs->fill_features(state, sent, features, start_index);
-    n_applications += 1;
-    n_features += features.size() - start_index;
 }
 
 void UnionList::fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features,
@@ -75,3 +57,105 @@ void UnionList::fill_features(const ParseState &state, const Sentence &sent, std
 bool CartesianProduct::good(const ParseState &state) const {
     return lhs->good(state) && rhs->good(state);
 }
+
+void CartesianProduct::compile(FeatureProgram &program) const {
+    lhs->compile(program);
+    rhs->compile(program);
+}
+
+void UnionList::compile_program() {
+    program = FeatureProgram();
+    auto &instructions = program.instructions;
+    uint32_t feature_num = 0;
+    for (const auto &operand : operands) {
+        size_t begin_index = instructions.size();
+        FeatureInstruction begin;
+        begin.op = FeatureInstruction::Op::BEGIN_FEATURE;
+        begin.feature_num = feature_num++;
+        instructions.push_back(begin);
+
+        operand->compile(program);
+        instructions[begin_index].length = static_cast<uint32_t>(instructions.size() - begin_index - 1);
+    }
+
+    specialized = find_specialized_extractor(name, program);
+}
+
+void FeatureProgram::add_location(state_location::LocationName location, namespace_t ns,
+                                  token_index_t token_specific_ns) {
+    FeatureInstruction instruction;
+    instruction.op = FeatureInstruction::Op::LOCATION;
+    instruction.location = static_cast<uint8_t>(location);
+
+    auto same_operand = [&](const FeatureOperand &operand) {
+        return operand.location == location && operand.ns == ns && operand.token_specific_ns == token_specific_ns;
+    };
+    auto operand = std::find_if(operands.begin(), operands.end(), same_operand);
+    if (operand == operands.end()) {
+        operands.push_back({static_cast<uint8_t>(location), ns, token_specific_ns});
+        operand = operands.end() - 1;
+    }
+    instruction.operand = static_cast<uint32_t>(operand - operands.begin());
+    instructions.push_back(instruction);
+}
+
+void FeatureProgram::fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features,
+                                   FeatureProgramScratch &scratch) const {
+    const auto &locations = state.locations_;
+
+    // Look up and hash the attributes of every operand once
+    begin_operands(scratch, operands.size());
+    for (size_t i = 0; i < operands.size(); i++)
+        prehash_operand(scratch, i, locations[operands[i].location], operands[i], sent);
+    end_operands(scratch, operands.size());
+
+    const FeatureInstruction *instruction = instructions.data();
+    const FeatureInstruction *end = instruction + instructions.size();
+    while (instruction != end) {
+        assert(instruction->op == FeatureInstruction::Op::BEGIN_FEATURE);
+        size_t feature_num = instruction->feature_num;
+        const FeatureInstruction *first = instruction + 1;
+        const FeatureInstruction *last = first + instruction->length;
+        instruction = last;
+
+        // The feature is only made if all of its locations are present in the state
+        bool good = true;
+        for (auto location = first; location != last; location++)
+            good = good && locations[location->location] != -1;
+        if (!good)
+            continue;
+
+        size_t start_index = features.size();
+        features.push_back(FeatureKey(feature_num));
+        for (auto location = first; location != last; location++)
+            add_operand(features, start_index, scratch, location->operand);
+    }
+}
+
+namespace {
+
+std::vector<const SpecializedExtractor *> &specialized_extractors() {
+    static std::vector<const SpecializedExtractor *> extractors;
+    return extractors;
+}
+
+}
+
+bool register_specialized_extractor(const SpecializedExtractor *extractor) {
+    specialized_extractors().push_back(extractor);
+    return true;
+}
+
+specialized_fill_t find_specialized_extractor(const std::string &template_name, const FeatureProgram &program) {
+    for (auto extractor : specialized_extractors()) {
+        if (template_name != extractor->template_name || program.operands.size() != extractor->num_operands)
+            continue;
+
+        bool same_locations = true;
+        for (size_t i = 0; i < program.operands.size(); i++)
+            same_locations = same_locations && program.operands[i].location == extractor->operand_locations[i];
+        if (same_locations)
+            return extractor->fill;
+    }
+    return nullptr;
+}
@@ -10,7 +10,60 @@
 #include "features.h"
 #include <memory>
 
-using attribute_list_citerator = std::vector<Attribute>::const_iterator;
+using attribute_list_citerator = const Attribute *;
+
+// A token location and namespace whose attributes a compiled feature template combines
+struct FeatureOperand {
+    uint8_t location;
+    namespace_t ns;
+    token_index_t token_specific_ns;
+};
+
+// One step of a compiled feature template (see `FeatureProgram`)
+struct FeatureInstruction {
+    enum class Op : uint8_t {
+        // Starts feature number `feature_num`, which is the product of the `length` LOCATION instructions that follow
+        BEGIN_FEATURE,
+        // Combines the features made so far with the attributes of operand number `operand`,
+        // which is at `location`
+        LOCATION,
+    };
+    Op op;
+    uint8_t location = 0;
+    uint32_t operand = 0;
+    uint32_t feature_num = 0;
+    uint32_t length = 0;
+};
+
+// The attributes of the operands in the current state. One per thread.
+struct FeatureProgramScratch {
+    std::vector<PrehashedAttribute> attributes;
+    // The attributes of operand i are [operand_begin[i], operand_begin[i + 1]) of `attributes`
+    std::vector<uint32_t> operand_begin;
+};
+
+/**
+ * A feature template compiled into a flat array of instructions. Filling features with a program gives the same
+ * features in the same order as walking the tree of combiners it was compiled from, but without the virtual calls.
+ *
+ * A location and namespace that several templates use is a single operand, whose attributes are looked up and
+ * hashed once per state. The templates then only mix these hashes into their own. Shared conjunctions of several
+ * operands are still combined for each template, because each template's hashes start from its template number.
+ */
+struct FeatureProgram {
+    std::vector<FeatureOperand> operands;
+    std::vector<FeatureInstruction> instructions;
+
+    // Appends a LOCATION instruction, adding an operand for the location and namespace if there is none yet
+    void add_location(state_location::LocationName location, namespace_t ns, token_index_t token_specific_ns);
+    void fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features,
+                       FeatureProgramScratch &scratch) const;
+};
+
+// Feature extraction generated at build time for one fixed template (see specialized_extractor.h).
+// `operands` are those of the template's program.
+using specialized_fill_t = void (*)(const FeatureOperand *operands, const ParseState &state, const Sentence &sent,
+                                    std::vector<FeatureKey> &features, FeatureProgramScratch &scratch);
 
 struct FeatureCombinerBase {
     FeatureCombinerBase(std::string name) : name(name) {};
@@ -24,9 +77,10 @@ struct FeatureCombinerBase {
     virtual bool good(const ParseState &state) const {
         return true;
     }
-
-    int n_applications = 0;
-    int n_features = 0;
+    // Appends the LOCATION instructions of the combiner to `program`
+    virtual void compile(FeatureProgram &program) const {
+        throw std::runtime_error("Feature combiner '" + name + "' cannot be compiled");
+    };
 };
 
 using feature_combiner_uptr = std::unique_ptr<FeatureCombinerBase>;
@@ -46,6 +100,7 @@ struct Location : FeatureCombinerBase {
 
 
     bool good(const ParseState &state) const override;
+    void compile(FeatureProgram &program) const override;
 };
 
 
@@ -58,10 +113,25 @@ struct UnionList : FeatureCombinerBase {
                        [](const feature_combiner_uptr &fc) { return fc->name; }
         );
         name = boost::algorithm::join(names, " u\n");
-
+        compile_program();
     };
     // UnionList() : FeatureCombinerBase("Empty") {};
     std::list<feature_combiner_uptr > operands;
+    // Source of the template, kept so that it can be stored alongside a saved model.
+    std::string template_text;
+    // The operands compiled into a program, which is what the parser extracts features with
+    FeatureProgram program;
+    // The extractor generated at build time for this template, if there is one. It is used instead of the program.
+    specialized_fill_t specialized = nullptr;
+
+    void compile_program();
+    void extract(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features,
+                 FeatureProgramScratch &scratch) const {
+        if (specialized != nullptr)
+            specialized(program.operands.data(), state, sent, features, scratch);
+        else
+            program.fill_features(state, sent, features, scratch);
+    }
 
 
     void fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features,
@@ -87,6 +157,7 @@ struct CartesianProduct : BinaryCombiner {
                                size_t start_index) override;
 
     bool good(const ParseState &state) const override;
+    void compile(FeatureProgram &program) const override;
 };
 
 struct Union : BinaryCombiner {
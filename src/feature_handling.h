@@ -9,7 +9,10 @@
 #include <iterator>
 #include <ostream>
 #include <assert.h>
+#include <stdint.h>
+#include <memory>
 #include <unordered_map>
+#include <utility>
 
 
 #include "hash.h"
@@ -27,24 +30,40 @@ using attribute_t = int;
 using namespace_t = int;
 
 
+struct Sentence;
+struct DictionaryIdMap;
+
 /**
  * Maps words, part-of-speech tags, and labels to integers.
  */
 class CorpusDictionary {
 public:
     std::unordered_map<std::string, label_type_t> label_to_id;
-    label_type_t map_label(std::string);
+    label_type_t map_label(const std::string &);
     
     std::unordered_map<std::string, attribute_t> attribute_to_id;
-    attribute_t map_attribute(std::string);
+    attribute_t map_attribute(const std::string &);
 
     std::unordered_map<std::string, namespace_t> namespace_to_id;
-    namespace_t map_namespace(std::string);
+    namespace_t map_namespace(const std::string &);
 
     bool frozen = false;
+
+    // Adds the entries of `other` in the order of their ids in `other`. Returns how to translate the ids of
+    // sentences read with `other` to ids of this dictionary.
+    DictionaryIdMap merge(const CorpusDictionary &other);
 private:
     template <typename T>
-    T map_any(std::unordered_map<std::string, T> &, std::string);
+    T map_any(std::unordered_map<std::string, T> &, const std::string &);
+};
+
+// Translates the ids of one dictionary to those of another. Entry i is the new id of old id i.
+struct DictionaryIdMap {
+    std::vector<label_type_t> labels;
+    std::vector<attribute_t> attributes;
+    std::vector<namespace_t> namespaces;
+
+    void apply(Sentence &sentence) const;
 };
 
 template <typename Key, typename Value>
@@ -57,9 +76,9 @@ std::unordered_map<Value, Key> invert_map(std::unordered_map<Key, Value> & orig_
 
 
 struct Attribute {
-    size_t index;
+    attribute_t index;
     weight_t value;
-    Attribute(size_t index, weight_t value) : index(index), value(value) {};
+    Attribute(attribute_t index, weight_t value) : index(index), value(value) {};
 };
 
 // Printable characters are in the range 32 - 126, both inclusive
@@ -67,34 +86,34 @@ constexpr size_t first_printable_char = 32;
 constexpr size_t last_printable_char = 126;
 constexpr size_t num_printable_chars = last_printable_char - first_printable_char + 1;
 
-using attribute_vector = std::vector<Attribute>;
-
-// FIXME better name
+// A namespace of a token. Its attributes are the range [attributes_begin, attributes_end) of `Sentence::attributes`.
 struct NamespaceFront {
     namespace_t index = -1;
     token_index_t token_specific_ns = -1;
-    attribute_vector attributes;
-    // std::vector<attribute_vector> edge_attributes {};
-    /*
-    NamespaceFront() {
-        std::cout << "Constructor called " << attributes.size() << "\n";
-    }
-    */
+    uint32_t attributes_begin = 0;
+    uint32_t attributes_end = 0;
 };
 
 
+// Identifier of a token, as a range of the text of its sentence (see `Sentence::text`)
+struct TokenId {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// A token's namespaces are the range [namespaces_begin, namespaces_end) of `Sentence::namespaces`
 struct Token {
-    std::string id;
-    std::vector<Attribute> attributes {};
-    std::vector<attribute_vector> namespaces {};
-    std::vector<NamespaceFront> namespaces_ng {};
-    attribute_vector _empty_attribute_vector {};
+    TokenId id;
     label_type_t label;
     token_index_t index;
     token_index_t head;
-    const attribute_vector & find_namespace(namespace_t ns, namespace_t token_specific_ns = -1) const;
+    uint32_t namespaces_begin = 0;
+    uint32_t namespaces_end = 0;
 };
 
+// A range of attributes within a sentence
+using attribute_range = std::pair<const Attribute *, const Attribute *>;
+
 struct ParseResult {
     std::vector<token_index_t> heads;
     std::vector<label_type_t> labels;
@@ -112,6 +131,8 @@ struct ParseScore {
     unsigned int num_total = 0;
     float uas();
     float las();
+    // Adds the counts of another score, e.g. one kept by another thread
+    void add(const ParseScore &other);
 };
 
 
@@ -124,6 +145,19 @@ struct ArcConstraint {
     ArcConstraint(token_index_t head, token_index_t dep, label_type_t label) : head(head), dep(dep), label(label) { }
 };
 
+// Positions of the items, such as constraints, that involve each token. Those of token i are
+// [begin[i], begin[i + 1]) of `items`, in the order of the items.
+struct TokenIndex {
+    std::vector<uint32_t> begin;
+    std::vector<uint32_t> items;
+
+    // Builds the index from (token, item) pairs given in item order
+    void build(size_t num_tokens, const std::vector<std::pair<token_index_t, uint32_t>> &entries);
+    std::pair<const uint32_t *, const uint32_t *> of(token_index_t index) const {
+        return std::make_pair(items.data() + begin[index], items.data() + begin[index + 1]);
+    }
+};
+
 struct ParseState;
 
 struct SpanConstraint {
@@ -138,15 +172,88 @@ struct SpanConstraint {
     }
 };
 
+/**
+ * A sentence is stored in a few flat arrays rather than with vectors in every token: the namespaces of all tokens
+ * in token order, and the attributes of all namespaces in namespace order. Tokens and namespaces refer to ranges
+ * of these arrays.
+ *
+ * Namespaces are looked up through an index with a cell for every token and namespace id, which
+ * `index_namespaces` builds once the sentence is complete, and again whenever the namespace ids change.
+ * `index_constraints` likewise builds the lists of arc and span constraints that involve each token.
+ */
 struct Sentence {
 	std::vector <Token> tokens;
+    std::vector <NamespaceFront> namespaces;
+    std::vector <Attribute> attributes;
     std::vector <ArcConstraint> arc_constraints;
     std::vector <SpanConstraint> span_constraints;
+    // The characters the token identifiers point into. This is either the sentence's part of a memory-mapped
+    // corpus file, which the pointer keeps mapped, or a buffer owned by the sentence.
+    std::shared_ptr<const char> text;
+
+    // Position in `namespaces` of the namespace of each token, by token and then namespace id, or `no_namespace`.
+    // Only namespaces without a token-specific index are in the table. The others are in
+    // `token_specific_namespaces`, keyed by the cell of the table and the token-specific index.
+    static constexpr uint32_t no_namespace = UINT32_MAX;
+    std::vector<uint32_t> namespace_table;
+    uint32_t namespace_table_width = 0;
+    std::unordered_map<uint64_t, uint32_t> token_specific_namespaces;
+
+    // Positions in `arc_constraints` of the constraints whose head or dependent is each token,
+    // and positions in `span_constraints` of the spans that contain each token
+    TokenIndex arc_constraints_by_token;
+    TokenIndex span_constraints_by_token;
+
+    std::string token_id(token_index_t index) const {
+        const auto &id = tokens[index].id;
+        return id.length > 0 ? std::string(text.get() + id.offset, id.length) : std::string();
+    }
+
+    attribute_range namespace_attributes(const NamespaceFront &ns) const {
+        return std::make_pair(attributes.data() + ns.attributes_begin, attributes.data() + ns.attributes_end);
+    }
+    // The attributes of token `index` in namespace `ns`. Empty if the token does not have the namespace.
+    // Takes constant time.
+    attribute_range find_namespace(token_index_t index, namespace_t ns, token_index_t token_specific_ns = -1) const;
+    void index_namespaces();
+    void index_constraints();
 
 	bool has_edge(token_index_t, token_index_t) const;
     void score(const ParseResult &result, ParseScore &parse_score) const;
 };
 
+inline attribute_range Sentence::find_namespace(token_index_t index, namespace_t ns,
+                                                token_index_t token_specific_ns) const {
+    if (static_cast<uint32_t>(ns) >= namespace_table_width)
+        return attribute_range(nullptr, nullptr);
+
+    size_t cell = static_cast<size_t>(index) * namespace_table_width + ns;
+    uint32_t position = no_namespace;
+    if (token_specific_ns == -1) {
+        position = namespace_table[cell];
+    } else {
+        auto it = token_specific_namespaces.find(static_cast<uint64_t>(static_cast<uint32_t>(token_specific_ns)) << 32 | cell);
+        if (it != token_specific_namespaces.end())
+            position = it->second;
+    }
+
+    if (position == no_namespace)
+        return attribute_range(nullptr, nullptr);
+    return namespace_attributes(namespaces[position]);
+}
+
+/**
+ * Hands out the sentences of one pass over a data set. Implementations must be thread-safe, so that several
+ * training threads can take sentences from the same stream.
+ */
+class SentenceStream {
+public:
+    virtual ~SentenceStream() = default;
+    // Points `sentence` to the next sentence and sets `index` to its position in the data set. The sentence either
+    // stays owned by the stream or is moved into `storage`. Returns false when the pass is over.
+    virtual bool next(Sentence &storage, const Sentence *&sentence, size_t &index) = 0;
+};
+
 
 namespace state_location {
     enum LocationName {
@@ -187,30 +294,62 @@ using state_location_t = std::array<token_index_t, state_location::LocationName:
 struct SpanState {
     size_t num_connected_components;
     token_index_t designated_root;
-    SpanState() : num_connected_components(0), designated_root(-1) { };
+    // Number of tokens of the span on the stack without a head. Kept by `update_span_states`.
+    size_t headless_nodes_in_stack;
+    SpanState() : num_connected_components(0), designated_root(-1), headless_nodes_in_stack(0) { };
 };
 
 
+// The outermost dependents of a token on each side, or -1. Kept up to date as edges are added.
+struct TokenModifiers {
+    token_index_t left = -1; // Leftmost dependent
+    token_index_t left2 = -1; // Second leftmost dependent
+    token_index_t right = -1; // Rightmost dependent
+    token_index_t right2 = -1; // Second rightmost dependent
+};
+
 struct ParseState {
 	size_t length;
 	std::vector<token_index_t> stack;
     token_index_t n0;
 	std::vector<token_index_t> heads;
     std::vector<label_type_t> labels;
+    std::vector<TokenModifiers> modifiers;
+    // Whether each token is on the stack
+    std::vector<char> on_stack;
     state_location_t locations_ {};
     std::vector<SpanState> span_states {};
 
+    // An empty state, to be `reset` for a sentence
+    ParseState() : length(0), n0(0) { }
     ParseState(size_t length);
-    ParseState(size_t length, size_t num_span_constraints);
+    ParseState(size_t length, const std::vector<SpanConstraint> &span_constraints);
+    // Also keeps the bookkeeping on the gold tree of `sent` that `ArcEager::oracle` needs
+    explicit ParseState(const Sentence &sent);
+
+    // Start over as the initial state of the constructors with the same arguments. The memory of the vectors is
+    // kept, so a state reused for sentences no longer than the ones before it does not allocate.
+    void reset(size_t length);
+    void reset(size_t length, const std::vector<SpanConstraint> &span_constraints);
+    void reset(const Sentence &sent);
     // FIXME span constraints starting at the first node won't work
 
+    // Bookkeeping on the gold tree, only kept by states made from a sentence. For each token: how many of the tokens
+    // on the stack have it as their gold head, and its rightmost gold dependent or -1.
+    std::vector<token_index_t> gold_deps_on_stack;
+    std::vector<token_index_t> gold_rightmost_dep;
+    bool tracks_gold() const { return !gold_deps_on_stack.empty(); }
+
+    void push(token_index_t index, const std::vector<Token> &tokens);
+    void pop(const std::vector<Token> &tokens);
+
 	void add_edge(token_index_t head, token_index_t dep, label_type_t label);
 
+    // Takes constant time, since the modifiers of each token are kept by `add_edge`
     void update_locations();
 
-    int find_left_dep(token_index_t middle, token_index_t start) const;
-    int find_right_dep(token_index_t middle, token_index_t end) const;
-
+    // Whether the gold head or a gold dependent of a token is in the buffer or on the stack. Constant time.
+    // All but `has_head_in_buffer` need the gold bookkeeping.
     bool has_head_in_buffer(token_index_t, const Sentence &) const;
     bool has_head_in_stack(token_index_t, const Sentence &) const;
     bool has_dep_in_buffer(token_index_t, const Sentence &) const;
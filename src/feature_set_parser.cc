@@ -3,6 +3,7 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <assert.h>
 #include "feature_set_parser.h"
 
@@ -242,9 +243,16 @@ std::unique_ptr<UnionList> read_feature_file(std::string filename, CorpusDiction
     if (!infile.good())
         throw std::runtime_error("File " + filename + " cannot be read");
 
+    std::stringstream template_text;
+    template_text << infile.rdbuf();
+    return parse_feature_template(template_text.str(), dict);
+}
+
+std::unique_ptr<UnionList> parse_feature_template(const std::string &template_text, CorpusDictionary & dict) {
+    std::istringstream template_stream(template_text);
     std::string line;
     std::list<feature_combiner_uptr > combiners;
-    while (std::getline(infile, line)) {
+    while (std::getline(template_stream, line)) {
         // Ignore everything after comments
         line = line.substr(0, line.find_first_of('#'));
         boost::algorithm::trim(line);
@@ -258,5 +266,6 @@ std::unique_ptr<UnionList> read_feature_file(std::string filename, CorpusDiction
 
 
     auto union_list = make_unique<UnionList>(combiners);
+    union_list->template_text = template_text;
     return union_list;
 }
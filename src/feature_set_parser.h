@@ -69,4 +69,5 @@ std::vector<lex_token_uptr> tokenize_line(std::string line, CorpusDictionary & d
 std::vector<lex_token_uptr> infix_to_prefix(std::vector<lex_token_uptr > & infix_tokens);
 feature_combiner_uptr make_feature_combiner(std::vector<lex_token_uptr> & prefix_tokens);
 feature_combiner_uptr parse_feature_line(std::string line, CorpusDictionary & dict);
-std::unique_ptr<UnionList> read_feature_file(std::string filename, CorpusDictionary & dict);
\ No newline at end of file
+std::unique_ptr<UnionList> read_feature_file(std::string filename, CorpusDictionary & dict);
+std::unique_ptr<UnionList> parse_feature_template(const std::string &template_text, CorpusDictionary & dict);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include "features.h"
+#include "score_kernel.h"
 
 using namespace std;
 
@@ -27,17 +28,17 @@ AttributeExtractor::extract(const ParseState &state, const Sentence &sent) const
     if (token_index >= 0 && token_index < sent.tokens.size()) {
         auto &token = sent.tokens[token_index];
 
-        for (auto & ns_front : token.namespaces_ng) {
+        for (auto i = token.namespaces_begin; i < token.namespaces_end; i++) {
+            auto &ns_front = sent.namespaces[i];
             // cerr << "ns_front.index = " << ns_front.index << " vs. " << ns << "\n";
             if (ns_front.index == ns) {
-                // cerr << "Found ns front with size " << ns_front.attributes.size() << "\n";
-                return make_pair(ns_front.attributes.cbegin(), ns_front.attributes.cend());
+                return sent.namespace_attributes(ns_front);
             }
         }
 
     }
 
-    return make_pair(_empty_attribute_vector.cend(), _empty_attribute_vector.cend());
+    return attribute_range(nullptr, nullptr);
 
 };
 
@@ -46,10 +47,11 @@ void AttributeExtractor::fill_features(const ParseState &state, const Sentence &
     assert(token_index < sent.tokens.size());
 
     if (token_index >= 0) {
-        auto & attributes_in_ns = sent.tokens[token_index].namespaces[ns];
+        auto attributes_in_ns = extract(state, sent).first;
+        size_t num_attributes = extract(state, sent).second - attributes_in_ns;
         size_t initial_vector_size = features.size();
         for (size_t i = start_index; i < initial_vector_size; i++) {
-            for (size_t j = 1; j < attributes_in_ns.size(); j++) {
+            for (size_t j = 1; j < num_attributes; j++) {
                 // Make a copy of the current features by inserting it into the vector
                 features.push_back(features[i]);
                 features.back().add_attribute(attributes_in_ns[i]);
@@ -74,7 +76,8 @@ void FeatureKey::add_part(T part) {
 }
 
 void FeatureKey::add_attribute(Attribute attribute) {
-    hash_combine(hashed_val, attribute.index);
+    // Hashed as a size_t, with -1 for unknown attributes becoming the largest value
+    hash_combine(hashed_val, static_cast<size_t>(attribute.index));
     value *= attribute.value;
 }
 
@@ -100,19 +103,35 @@ WeightSection & WeightMap::get(FeatureKey key) {
 */
 
 float *WeightMap::get_or_insert(FeatureKey key) {
-    float * val_ptr = table_block.lookup(key.hashed_val);
-    if (val_ptr == nullptr)
-        return table_block.insert(key.hashed_val);
-    else
-        return val_ptr;
+    // `insert` returns the existing section if there is one, so a single probe suffices
+    return table_block.insert(key.hashed_val);
 }
 
 WeightSectionWrap WeightMap::get_or_insert_section(FeatureKey key) {
-    float * val_ptr = table_block.lookup(key.hashed_val);
-    if (val_ptr == nullptr)
-        return WeightSectionWrap(table_block.insert(key.hashed_val), section_size);
-    else
-        return WeightSectionWrap(val_ptr, section_size);
+    return WeightSectionWrap(table_block.insert(key.hashed_val), aligned_section_size);
+}
+
+WeightSectionWrap WeightMap::get_or_insert_section_concurrent(FeatureKey key) {
+    float *val_ptr;
+    while ((val_ptr = table_block.insert_concurrent(key.hashed_val)) == nullptr) {
+        // The table is full. Wait for the other threads to let go of the table, and grow it,
+        // unless another thread got there first.
+        resize_lock->unlock_shared();
+        {
+            std::unique_lock<ReadWriteLock> exclusive(*resize_lock);
+            table_block.grow();
+        }
+        resize_lock->lock_shared();
+    }
+    return WeightSectionWrap(val_ptr, aligned_section_size);
+}
+
+/**
+* Return the weight block for the given feature, or nullptr if the feature has never been updated.
+* Never inserts, so the table does not grow while scoring.
+*/
+const float *WeightMap::find_weights(FeatureKey key) {
+    return table_block.lookup(key.hashed_val);
 }
 
 WeightSectionWrap WeightMap::get_section(size_t key) {
@@ -120,11 +139,14 @@ WeightSectionWrap WeightMap::get_section(size_t key) {
     if (val_ptr == nullptr)
         throw std::out_of_range("Key " + std::to_string(key) + " not found");
     else
-        return WeightSectionWrap(val_ptr, section_size);
+        return WeightSectionWrap(val_ptr, aligned_section_size);
 }
 
 WeightMap::WeightMap(size_t section_size_)
-        : table_block(8388608, section_size_ * WeightSectionWrap::num_blocks), section_size(section_size_)  {
+        : table_block(8388608, padded_row_size(section_size_) * WeightSectionWrap::num_blocks),
+          resize_lock(new ReadWriteLock()),
+          section_size(section_size_), aligned_section_size(padded_row_size(section_size_)),
+          section_locks(new std::mutex[num_section_locks]) {
 }
 
 void ProductCombiner::fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features, size_t start_index) {
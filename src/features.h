@@ -1,15 +1,26 @@
 #ifndef FEATURES_H
 #define FEATURES_H
 
+#include <cassert>
 #include <iostream>
 #include <string>
 #include <array>
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <mutex>
 
 #include "feature_handling.h"
 #include "hash.h"
 #include "hashtable.h"
+#include "hashtable_block.h"
+#include "read_write_lock.h"
+
+// An attribute whose index has been hashed ahead of combining it into feature keys (see `prehash`)
+struct PrehashedAttribute {
+    size_t hash;
+    weight_t value;
+};
 
 struct FeatureKey {
     size_t hashed_val = 0;
@@ -21,6 +32,11 @@ struct FeatureKey {
     void add_part(T);
 
     void add_attribute(Attribute);
+    // Same as adding the attribute the prehashed attribute was made from
+    void add_attribute(PrehashedAttribute attribute) {
+        hash_combine_prehashed(hashed_val, attribute.hash);
+        value *= attribute.value;
+    }
 
     // Conceptually the value is not part of the key,
     // but it is kept here for convenience.
@@ -29,7 +45,7 @@ struct FeatureKey {
     FeatureKey(size_t feature_num = 0) : hashed_val(feature_num), value(1.0) { };
 };
 
-using attribute_list_citerator = std::vector<Attribute>::const_iterator;
+using attribute_list_citerator = const Attribute *;
 // Atomic attribute
 
 struct ExtractorBase {
@@ -42,7 +58,6 @@ public:
     state_location::LocationName location;
     namespace_t ns;
     std::pair<attribute_list_citerator, attribute_list_citerator> extract(const ParseState &state, const Sentence &sent) const;
-    std::vector<Attribute> _empty_attribute_vector {};
 
     void fill_features(const ParseState &state, const Sentence &sent, std::vector<FeatureKey> & features, size_t start_index) override;
 
@@ -94,13 +109,32 @@ struct HashCell {
 
 // A weight section consists of a number of named blocks.
 // Idea: generalize this concept by using enums for names and 2D Eigen for data storage.
+//
+// Averaging keeps, next to each weight w, the sum u of its changes each multiplied by the number of updates made
+// before it. The average of w over all c updates is then w - u / c, so no weight needs to be brought up to date
+// with the updates it missed, and no per-weight timestamps are kept. The sums are doubles, which count updates
+// exactly far beyond the 2^24 that a float can.
 struct WeightSectionWrap {
-    WeightSectionWrap(float * const base, const size_t num_elems) : base(base), num_elems(num_elems) {};
+    // The doubles start right after the weights, so `num_elems` must be even to keep them aligned
+    WeightSectionWrap(float * const base, const size_t num_elems) : base(base), num_elems(num_elems) {
+        assert(num_elems % 2 == 0);
+    };
     inline float * const weights() { return base; };
-    inline float * const acc_weights() { return base + num_elems; };
-    inline float * const update_timestamps() { return base + num_elems * 2; };
+    inline double * const weighted_updates() { return reinterpret_cast<double *>(base + num_elems); };
+
+    // Adds `change` to weight `i` in update number `update_number`, counting from 1
+    inline void add(size_t i, float change, size_t update_number) {
+        weights()[i] += change;
+        weighted_updates()[i] += static_cast<double>(update_number - 1) * change;
+    }
+    // The average of weight `i` after each of the first `num_updates` updates
+    inline float average(size_t i, size_t num_updates) {
+        return static_cast<float>(weights()[i] - weighted_updates()[i] / static_cast<double>(num_updates));
+    }
+
     float * const base;
     size_t num_elems;
+    // The weights and the weighted updates, which take two blocks of floats
     const static size_t num_blocks = 3;
 };
 
@@ -113,15 +147,30 @@ public:
     float *get_or_insert(FeatureKey);
     std::vector<size_t> all_keys();
     WeightSectionWrap get_or_insert_section(FeatureKey);
+    const float *find_weights(FeatureKey);
     WeightSectionWrap get_section(size_t);
     HashTableBlock table_block;
     size_t num_updates = 0;
 
+    // Shared training (Hogwild). Weights are read and written without locks, but a thread must hold a shared
+    // lock on `resize_lock` while it uses pointers into the table, since growing the table moves all sections.
+    // `get_or_insert_section_concurrent` temporarily trades that shared lock for an exclusive one
+    // when the table has to grow.
+    WeightSectionWrap get_or_insert_section_concurrent(FeatureKey);
+    // Lock guarding the updates of the sections whose keys map to it
+    std::mutex &section_lock(FeatureKey key) {
+        return section_locks[(integerHash(key.hashed_val) >> 32) & (num_section_locks - 1)];
+    }
+    std::unique_ptr<ReadWriteLock> resize_lock;
+
     // Temp made public
-    size_t section_size;
+    size_t section_size = 0;
+    // Each block of a section is padded to the SIMD width
+    size_t aligned_section_size = 0;
 
 private:
-    // size_t aligned_section_size;
+    const static size_t num_section_locks = 4096;
+    std::unique_ptr<std::mutex[]> section_locks;
 };
 
 
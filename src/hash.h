@@ -25,10 +25,22 @@ inline void hash_combine(std::size_t & seed, const T & v)
     seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 }
 
+// The part of `hash_combine<size_t>` that depends only on the value, so that it can be computed once for a value
+// that is combined into many seeds
+inline std::size_t prehash(std::size_t v)
+{
+    return integerHash(v) + 0x9e3779b9;
+}
+
+inline void hash_combine_prehashed(std::size_t & seed, std::size_t prehashed)
+{
+    seed ^= prehashed + (seed << 6) + (seed >> 2);
+}
+
 template <>
 inline void hash_combine<size_t>(std::size_t & seed, const size_t & v)
 {
-    seed ^= integerHash(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    hash_combine_prehashed(seed, prehash(v));
 }
 
 
@@ -3,8 +3,11 @@
 #include <math.h>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <limits>
 
 #include "hashtable_block.h"
+#include "score_kernel.h"
 
 
 /**
@@ -20,7 +23,7 @@ HashTableBlock::HashTableBlock(size_t initial_size, size_t value_block_size)
     assert(is_power_of_two(initial_size));
     // assert(value_block_size / sizeof(Cell::value_type) == 0);
     keys.resize(initial_size, 0);
-    aligned_value_block_size = value_block_size + value_block_size / sizeof(Cell::value_type);
+    aligned_value_block_size = padded_row_size(value_block_size);
     values.resize(aligned_value_block_size * initial_size, 0);
     inserts_before_resize = static_cast<size_t>(initial_size * 0.75);
 }
@@ -29,16 +32,20 @@ HashTableBlock::HashTableBlock(size_t initial_size, size_t value_block_size)
 Cell::value_type * HashTableBlock::lookup(size_t key)
 {
     size_t candidate_index = hash_key(key);
+    // Keys are loaded atomically, since `insert_concurrent` may claim cells while we probe.
+    // A relaxed load is an ordinary load on the platforms we target.
     // Forward search
-    for (int i = candidate_index; i < keys.size(); i++) {
-        if (keys[i] == key) return &values[aligned_value_block_size * i];
-        if (keys[i] == 0) return nullptr;
+    for (size_t i = candidate_index; i < keys.size(); i++) {
+        size_t cell_key = __atomic_load_n(&keys[i], __ATOMIC_RELAXED);
+        if (cell_key == key) return &values[aligned_value_block_size * i];
+        if (cell_key == 0) return nullptr;
     }
 
     // Search from the beginning
-    for (int i = 0; i < candidate_index; i++) {
-        if (keys[i] == key) return &values[aligned_value_block_size * i];
-        if (keys[i] == 0) return nullptr;
+    for (size_t i = 0; i < candidate_index; i++) {
+        size_t cell_key = __atomic_load_n(&keys[i], __ATOMIC_RELAXED);
+        if (cell_key == key) return &values[aligned_value_block_size * i];
+        if (cell_key == 0) return nullptr;
     }
 
     return nullptr;
@@ -71,11 +78,49 @@ Cell::value_type * HashTableBlock::insert_at(size_t key, size_t index) {
         return insert(key);
     } else {
         inserts_before_resize--;
+        num_entries_++;
         keys[index] = key;
         return &values[aligned_value_block_size * index];
     }
 }
 
+Cell::value_type * HashTableBlock::insert_concurrent(size_t key)
+{
+    size_t candidate_index = hash_key(key);
+    for (size_t probe_i = 0; probe_i < keys.size(); probe_i++) {
+        size_t i = (candidate_index + probe_i) & (keys.size() - 1);
+        size_t cell_key = __atomic_load_n(&keys[i], __ATOMIC_ACQUIRE);
+        if (cell_key == key) return &values[aligned_value_block_size * i];
+        if (cell_key != 0) continue;
+
+        // Reserve room for the key before claiming the cell, so the load factor is respected
+        size_t remaining = __atomic_load_n(&inserts_before_resize, __ATOMIC_RELAXED);
+        do {
+            if (remaining == 0)
+                return nullptr;
+        } while (!__atomic_compare_exchange_n(&inserts_before_resize, &remaining, remaining - 1, true,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        size_t expected = 0;
+        if (__atomic_compare_exchange_n(&keys[i], &expected, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_add_fetch(&num_entries_, 1, __ATOMIC_RELAXED);
+            return &values[aligned_value_block_size * i];
+        }
+
+        // Another thread claimed the cell first. Give back the reservation.
+        __atomic_add_fetch(&inserts_before_resize, 1, __ATOMIC_RELAXED);
+        if (expected == key) return &values[aligned_value_block_size * i];
+    }
+
+    return nullptr;
+}
+
+void HashTableBlock::grow()
+{
+    if (inserts_before_resize == 0)
+        resize(keys.size() * 2);
+}
+
 void HashTableBlock::resize(size_t new_size)
 {
     std::cout << "Repopulating. Old size was " << keys.size() << ", new size will be " << new_size << "\n";
@@ -85,12 +130,13 @@ void HashTableBlock::resize(size_t new_size)
     // Initialize higher capacity data structures.
     // Their names are prefixed with "old", because they will be swapped with the actual old data structures shortly
     std::vector<size_t> old_keys(new_size, 0);
-    std::vector<Cell::value_type> old_values(new_size * aligned_value_block_size, 0);
+    aligned_vector<Cell::value_type> old_values(new_size * aligned_value_block_size, 0);
 
     // There...
     keys.swap(old_keys);
     values.swap(old_values);
     inserts_before_resize = static_cast<size_t>(new_size * 0.75);
+    num_entries_ = 0;
 
     // Re-insert everything.
     // std::cout << "Re-inserting ";
@@ -105,3 +151,54 @@ void HashTableBlock::resize(size_t new_size)
     std::cout << "Repopulating done...\n";
 }
 
+size_t HashTableBlock::memory_usage() const {
+    return keys.size() * sizeof(size_t) + values.size() * sizeof(Cell::value_type);
+}
+
+
+
+StaticHashTableBlock::StaticHashTableBlock(const std::vector<size_t> &keys, const std::vector<Cell::value_type> &values,
+                                           size_t stride)
+        : num_entries_(keys.size()), stride_(stride)
+{
+    assert(values.size() == keys.size() * stride);
+    assert(keys.size() < std::numeric_limits<uint32_t>::max());
+
+    // Between one and two keys per bucket on average
+    num_buckets_ = std::max<size_t>(upper_power_of_two(keys.size()) / 2, 1);
+
+    // Counting sort of the keys by bucket
+    owned_bucket_offsets.assign(num_buckets_ + 1, 0);
+    for (size_t key : keys)
+        owned_bucket_offsets[(integerHash(key) & (num_buckets_ - 1)) + 1]++;
+    for (size_t b = 0; b < num_buckets_; b++)
+        owned_bucket_offsets[b + 1] += owned_bucket_offsets[b];
+
+    std::vector<uint32_t> next_free(owned_bucket_offsets.begin(), owned_bucket_offsets.end() - 1);
+    owned_keys.resize(keys.size());
+    owned_values.resize(values.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        assert(keys[i] != 0);
+        size_t dest = next_free[integerHash(keys[i]) & (num_buckets_ - 1)]++;
+        owned_keys[dest] = keys[i];
+        std::copy(values.begin() + i * stride, values.begin() + (i + 1) * stride, owned_values.begin() + dest * stride);
+    }
+
+    bucket_offsets_ = owned_bucket_offsets.data();
+    keys_ = owned_keys.data();
+    values_ = owned_values.data();
+}
+
+StaticHashTableBlock::StaticHashTableBlock(const uint32_t *bucket_offsets, const size_t *keys,
+                                           const Cell::value_type *values, size_t num_buckets, size_t num_entries,
+                                           size_t stride, std::shared_ptr<void> storage)
+        : external_storage(storage), bucket_offsets_(bucket_offsets), keys_(keys), values_(values),
+          num_buckets_(num_buckets), num_entries_(num_entries), stride_(stride)
+{
+    assert(is_power_of_two(num_buckets));
+    assert(bucket_offsets[num_buckets] == num_entries);
+}
+
+size_t StaticHashTableBlock::memory_usage() const {
+    return (num_buckets_ + 1) * sizeof(uint32_t) + num_entries_ * (sizeof(size_t) + stride_ * sizeof(Cell::value_type));
+}
\ No newline at end of file
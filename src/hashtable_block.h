@@ -5,7 +5,9 @@
 #include <stdint.h>
 #include <vector>
 #include <list>
+#include <memory>
 #include "hash.h"
+#include "aligned_allocator.h"
 
 //----------------------------------------------
 //  HashTable
@@ -43,24 +45,97 @@ public:
     HashTableBlock(size_t initial_size, size_t num_values_per_key);
 
     // Basic operations
+    // `lookup` returns nullptr for a missing key. `insert` returns the existing block if the key is present.
     Cell::value_type *lookup(size_t key);
     Cell::value_type *insert(size_t key);
 
-    // Keys temporarily made public
-    std::vector<size_t> keys;
+    // Thread-safe insert for use while other threads call `lookup` and `insert_concurrent`. Cells are claimed
+    // with an atomic compare-and-swap on the key. Returns nullptr instead of resizing when the table is full;
+    // the caller must then call `grow` while no other thread uses the table, and retry.
+    Cell::value_type *insert_concurrent(size_t key);
+    // Doubles the size of the table if it is full. Not thread-safe.
+    void grow();
+
+    // Raw cell access. Unused cells have key 0.
+    inline size_t num_cells() const { return keys.size(); }
+    inline size_t num_entries() const { return num_entries_; }
+    inline size_t key_at(size_t index) const { return keys[index]; }
+    inline Cell::value_type *values_at(size_t index) { return &values[aligned_value_block_size * index]; }
+    size_t memory_usage() const;
 
 private:
     inline size_t hash_key(size_t key) {
         return (integerHash(key)) & (keys.size() - 1);
     }
     Cell::value_type *insert_at(size_t key, size_t index);
-    std::vector<Cell::value_type > values;
+    std::vector<size_t> keys;
+    // Value blocks are padded to the SIMD width and the storage is cache line aligned,
+    // so every block starts on a vector boundary.
+    aligned_vector<Cell::value_type > values;
     size_t inserts_before_resize;
     size_t aligned_value_block_size;
+    size_t num_entries_ = 0;
 
     void resize(size_t desiredSize);
 };
 
+
+//----------------------------------------------
+//  StaticHashTableBlock
+//
+//  Read-only counterpart of HashTableBlock, built once from a fixed set of keys.
+//  Keys are grouped by bucket in a single dense array, and `bucket_offsets[b]` is the index of the first key
+//  of bucket b. Value blocks are stored in key order, so no memory is spent on empty cells.
+//  The arrays are either owned or live in external memory (e.g. a memory-mapped model file).
+//----------------------------------------------
+
+class StaticHashTableBlock
+{
+public:
+    StaticHashTableBlock() = default;
+    // `keys` must be unique and non-zero. `values` holds `stride` values per key, in the order of `keys`.
+    StaticHashTableBlock(const std::vector<size_t> &keys, const std::vector<Cell::value_type> &values, size_t stride);
+    // Wraps arrays in external memory. `storage` keeps that memory alive.
+    StaticHashTableBlock(const uint32_t *bucket_offsets, const size_t *keys, const Cell::value_type *values,
+                         size_t num_buckets, size_t num_entries, size_t stride, std::shared_ptr<void> storage);
+
+    // The array pointers refer into the vectors, which survive a move but not a copy.
+    StaticHashTableBlock(StaticHashTableBlock &&) = default;
+    StaticHashTableBlock &operator=(StaticHashTableBlock &&) = default;
+    StaticHashTableBlock(const StaticHashTableBlock &) = delete;
+    StaticHashTableBlock &operator=(const StaticHashTableBlock &) = delete;
+
+    inline const Cell::value_type *lookup(size_t key) const {
+        size_t bucket = integerHash(key) & (num_buckets_ - 1);
+        for (size_t i = bucket_offsets_[bucket]; i < bucket_offsets_[bucket + 1]; i++) {
+            if (keys_[i] == key)
+                return values_ + stride_ * i;
+        }
+        return nullptr;
+    }
+
+    inline size_t num_buckets() const { return num_buckets_; }
+    inline size_t num_entries() const { return num_entries_; }
+    inline size_t stride() const { return stride_; }
+    inline const uint32_t *bucket_offsets() const { return bucket_offsets_; }
+    inline const size_t *keys() const { return keys_; }
+    inline const Cell::value_type *values() const { return values_; }
+    size_t memory_usage() const;
+
+private:
+    std::vector<uint32_t> owned_bucket_offsets;
+    std::vector<size_t> owned_keys;
+    aligned_vector<Cell::value_type> owned_values;
+    std::shared_ptr<void> external_storage;
+
+    const uint32_t *bucket_offsets_ = nullptr;
+    const size_t *keys_ = nullptr;
+    const Cell::value_type *values_ = nullptr;
+    size_t num_buckets_ = 0;
+    size_t num_entries_ = 0;
+    size_t stride_ = 0;
+};
+
 /*
 inline uint32_t upper_power_of_two(uint32_t v)
 {
@@ -9,13 +9,17 @@
 
 #include <iostream>
 #include <fstream>
-#include <sstream> // stringstream
 #include <string> // getline
 #include <vector>
-#include <regex>
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <limits>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <thread>
+#include <stdint.h>
 
 #include "input.h"
 
@@ -28,218 +32,495 @@ VwSentenceReader::VwSentenceReader(string filename, CorpusDictionary &dictionary
 }
 
 
-void VwSentenceReader::parse_instance(string::const_iterator instance_begin, string::const_iterator instance_end) {
-    auto first_bar_pos = find(instance_begin, instance_end, '|');
+namespace {
+
+// The characters matched by \s
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Reads an optionally negative decimal integer starting at `pos`, and moves `pos` past it.
+// Returns false if there are no digits or the number does not fit in an int.
+bool scan_int(const char *&pos, const char *end, int &value) {
+    const char *p = pos;
+    bool negative = p < end && *p == '-';
+    if (negative)
+        p++;
+    if (p == end || !is_digit(*p))
+        return false;
+
+    long long magnitude = 0;
+    for (; p < end && is_digit(*p); p++) {
+        magnitude = magnitude * 10 + (*p - '0');
+        if (magnitude > static_cast<long long>(std::numeric_limits<int>::max()) + 1)
+            return false;
+    }
+    if (!negative && magnitude > std::numeric_limits<int>::max())
+        return false;
+
+    value = static_cast<int>(negative ? -magnitude : magnitude);
+    pos = p;
+    return true;
+}
+
+// Parses the whole of [begin, end) as a floating point number.
+// Short decimals like "0.25" or "-3" take a fast path with a single correctly rounded division of two exact
+// floats, so the result is the same as strtof's. Everything else is left to strtof.
+bool parse_float(const char *begin, const char *end, float &value) {
+    const char *p = begin;
+    bool negative = p < end && (*p == '-' || *p == '+');
+    negative = negative && *p++ == '-';
+
+    uint32_t mantissa = 0;
+    int exponent = 0;
+    size_t num_digits = 0;
+    for (; p < end && is_digit(*p) && num_digits < 8; p++, num_digits++)
+        mantissa = mantissa * 10 + (*p - '0');
+    if (p < end && *p == '.') {
+        p++;
+        for (; p < end && is_digit(*p) && num_digits < 8; p++, num_digits++, exponent--)
+            mantissa = mantissa * 10 + (*p - '0');
+    }
+
+    // Up to 8 digits are below 2^24, and powers of ten up to 10^10 are exact in a float
+    static const float powers_of_ten[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    if (p == end && num_digits > 0 && mantissa < (1 << 24) && exponent >= -10) {
+        float result = static_cast<float>(mantissa) / powers_of_ten[-exponent];
+        value = negative ? -result : result;
+        return true;
+    }
+
+    // Slow path. strtof needs a terminated string.
+    std::string number(begin, end);
+    char *number_end = nullptr;
+    errno = 0;
+    value = strtof(number.c_str(), &number_end);
+    return !number.empty() && number_end == number.c_str() + number.size() && errno == 0;
+}
+
+}
+
+
+void VwSentenceReader::fail(const char *pos, const std::string &message) {
+    throw input_parse_error(message, pos - line_begin + 1);
+}
+
+void VwSentenceReader::parse_instance(const char *instance_begin, const char *instance_end) {
+    auto first_bar_pos = std::find(instance_begin, instance_end, '|');
     if (first_bar_pos != instance_end) {
         token = Token();
         parse_header(instance_begin, first_bar_pos);
+        token.namespaces_begin = token.namespaces_end = sent.namespaces.size();
         parse_body(first_bar_pos, instance_end);
+        token.namespaces_end = sent.namespaces.size();
         sent.tokens.push_back(token);
     } else {
-        throw input_parse_error("Bar '|' not found", 0);
+        fail(instance_end, "Bar '|' not found");
     }
 }
 
 
-void VwSentenceReader::parse_constraint(string::const_iterator constraint_begin, string::const_iterator constraint_end) {
-    // FIXME slow with lots of copying
-    std::stringstream ss(string(constraint_begin, constraint_end));
-    string constraint_type;
-    ss >> constraint_type;
-
-
-    if (constraint_type == "arc") {
-        while (!ss.eof()) {
-            sent.arc_constraints.emplace_back();
-            ArcConstraint &arc_constraint = sent.arc_constraints.back();
-            arc_constraint.label = -1;
-            ss >> arc_constraint.head;
-            if (ss.peek() != '-')
-                throw input_parse_error("Invalid constraint format", 0);
-            ss.seekg(1, ss.cur);
-            ss >> arc_constraint.dep;
-            ss >> std::ws;
-        }
-
-    } else if (constraint_type == "span") {
-        while (!ss.eof()) {
+void VwSentenceReader::parse_constraint(const char *constraint_begin, const char *constraint_end) {
+    // Constraint lines look like "#arc 1-0 3-2" and "#span 2-4"
+    const char *pos = constraint_begin;
+    while (pos < constraint_end && is_space(*pos))
+        pos++;
+    const char *type_begin = pos;
+    while (pos < constraint_end && !is_space(*pos))
+        pos++;
+
+    bool is_arc = std::equal(type_begin, pos, "arc") && pos - type_begin == 3;
+    bool is_span = std::equal(type_begin, pos, "span") && pos - type_begin == 4;
+    if (!is_arc && !is_span)
+        fail(type_begin, "Line expected to specify constraints and start with one of {arc, span}");
+
+    while (true) {
+        while (pos < constraint_end && is_space(*pos))
+            pos++;
+        if (pos == constraint_end)
+            break;
+
+        int first, second;
+        if (!scan_int(pos, constraint_end, first))
+            fail(pos, "Invalid constraint format: expected a number");
+        if (pos == constraint_end || *pos != '-')
+            fail(pos, "Invalid constraint format: expected '-'");
+        pos++;
+        if (!scan_int(pos, constraint_end, second))
+            fail(pos, "Invalid constraint format: expected a number");
+        if (pos < constraint_end && !is_space(*pos))
+            fail(pos, "Invalid constraint format: expected whitespace");
+
+        if (is_arc) {
+            sent.arc_constraints.emplace_back(first, second, -1);
+        } else {
             sent.span_constraints.emplace_back();
-            SpanConstraint &span_constraint = sent.span_constraints.back();
-            ss >> span_constraint.span_start;
-            if (ss.peek() != '-')
-                throw input_parse_error("Invalid constraint format", 0);
-            ss.seekg(1, ss.cur);
-            ss >> span_constraint.span_end;
-            ss >> std::ws;
+            sent.span_constraints.back().span_start = first;
+            sent.span_constraints.back().span_end = second;
         }
-    } else {
-        throw input_parse_error("Line expected to specify constraints and start with one of {arc, span}", 0);
     }
-
-
-
 }
 
-void VwSentenceReader::parse_header(string::const_iterator header_begin, string::const_iterator header_end) {
+void VwSentenceReader::parse_header(const char *header_begin, const char *header_end) {
     // Header example:
-    // nsubj-5 'id-of-content
-    static const regex header_regex("(-?\\d+)-(.*)\\s'(.*)");
-    smatch header_match{};
-    bool match = regex_match(header_begin, header_end, header_match, header_regex);
-
-    if (match) {
-        token.head = stoi(header_match[1].str());
-        token.label = dictionary.map_label(header_match[2].str());
-        token.id = header_match[3].str();
-    } else {
-        throw input_parse_error("Ill-formatted header", 0);
+    // 5-nsubj 'id-of-content
+    // The head is followed by a dash and the label. The identifier starts after the last apostrophe
+    // that follows whitespace, so both labels and identifiers may contain apostrophes.
+    const char *pos = header_begin;
+    int head;
+    if (!scan_int(pos, header_end, head))
+        fail(pos, "Ill-formatted header: expected the index of the head");
+    if (pos == header_end || *pos != '-')
+        fail(pos, "Ill-formatted header: expected '-' after the head");
+    const char *label_begin = pos + 1;
+
+    const char *id_mark = nullptr;
+    for (const char *p = header_end - 1; p > label_begin; p--) {
+        if (*p == '\'' && is_space(p[-1])) {
+            id_mark = p;
+            break;
+        }
     }
+    if (id_mark == nullptr)
+        fail(label_begin, "Ill-formatted header: expected whitespace and ' before the token identifier");
+
+    token.head = head;
+    key_buffer.assign(label_begin, id_mark - 1);
+    token.label = dictionary.map_label(key_buffer);
+    token.id = add_token_id(id_mark + 1, header_end);
 }
 
-void VwSentenceReader::parse_body(string::const_iterator body_begin, string::const_iterator body_end) {
-    // Feature section
-    ns_name = "*";
-
-    auto start_of_token = body_begin;
-    for (auto str_pos = body_begin; str_pos < body_end; str_pos++) {
-        // Tokens are delimited by whitespace. The line is padded with an extra whitespace.
-        if (*str_pos == ' ') {
-            if (*start_of_token == '|') {
-                parse_namespace_decl(start_of_token, str_pos);
-            } else {
-                parse_feature_decl(start_of_token, str_pos);
-            }
-            start_of_token = str_pos + 1;
+void VwSentenceReader::parse_body(const char *body_begin, const char *body_end) {
+    // Feature section. Tokens are delimited by spaces.
+    const char *pos = body_begin;
+    while (pos < body_end) {
+        if (*pos == ' ') {
+            pos++;
+            continue;
         }
+
+        const char *token_end = pos;
+        while (token_end < body_end && *token_end != ' ')
+            token_end++;
+
+        if (*pos == '|')
+            parse_namespace_decl(pos, token_end);
+        else
+            parse_feature_decl(pos, token_end);
+        pos = token_end;
     }
 }
 
-void VwSentenceReader::parse_feature_decl(string::const_iterator start_of_token, string::const_iterator str_pos) {// Feature declaration
+void VwSentenceReader::parse_feature_decl(const char *feature_begin, const char *feature_end) {
     weight_t val = 1;
 
     // Find the last colon in the string if any
     // Features have optional numerical values, which are marked by a colon
-    auto colon_pos = str_pos;
-    for (; colon_pos > start_of_token && (*colon_pos != ':'); colon_pos--);
+    const char *colon_pos = feature_end - 1;
+    for (; colon_pos > feature_begin && (*colon_pos != ':'); colon_pos--);
 
-    if (colon_pos != start_of_token) {
-        val = get_number_or_default(str_pos, colon_pos);
+    if (colon_pos != feature_begin) {
+        val = get_number_or_default(colon_pos + 1, feature_end);
     } else {
-        colon_pos = str_pos;
+        colon_pos = feature_end;
     }
 
-    feature.assign(start_of_token, colon_pos);
-
-    auto attribute_id = dictionary.map_attribute(feature);
-    auto & current_ns = token.namespaces_ng.back();
-    current_ns.attributes.emplace_back(attribute_id, val);
+    key_buffer.assign(feature_begin, colon_pos);
+    auto attribute_id = dictionary.map_attribute(key_buffer);
+    sent.attributes.push_back(Attribute {attribute_id, val});
+    sent.namespaces.back().attributes_end = sent.attributes.size();
 }
 
-void VwSentenceReader::parse_namespace_decl(string::const_iterator start_of_token, string::const_iterator str_pos) {
-    dependent_on_index = -1;
-    if (distance(start_of_token, str_pos) > 1) {
-        ns_name.assign(start_of_token + 1, str_pos);
-
-        // Check if ns is an edge-dependent namespace
-        auto dash_pos = ns_name.find('-');
-        if (dash_pos != string::npos) {
-            ns_name = ns_name.substr(0, dash_pos);
-            if (ns_name.size() == 0)
-                throw input_parse_error("Invalid namespace format", 0);
-            dependent_on_index = stoi(ns_name.substr(dash_pos + 1));
-        }
-    } else {
+void VwSentenceReader::parse_namespace_decl(const char *decl_begin, const char *decl_end) {
+    int dependent_on_index = -1;
+    const char *name_begin = decl_begin + 1;
+    const char *name_end = decl_end;
+
+    if (name_begin == name_end) {
         // Default namespace
-        ns_name = "*";
+        key_buffer.assign("*");
+    } else {
+        // Check if ns is an edge-dependent namespace, e.g. "|w-2"
+        const char *dash_pos = std::find(name_begin, name_end, '-');
+        if (dash_pos != name_end) {
+            if (dash_pos == name_begin)
+                fail(decl_begin, "Invalid namespace format: empty name");
+            const char *index_pos = dash_pos + 1;
+            if (!scan_int(index_pos, name_end, dependent_on_index) || index_pos != name_end)
+                fail(dash_pos + 1, "Invalid namespace format: expected a token index after '-'");
+            name_end = dash_pos;
+        }
+        key_buffer.assign(name_begin, name_end);
     }
 
     // Insert a new namespace
-    token.namespaces_ng.emplace_back();
-    auto & current_ns = token.namespaces_ng.back();
-    current_ns.index = dictionary.map_namespace(ns_name);
+    sent.namespaces.emplace_back();
+    auto & current_ns = sent.namespaces.back();
+    current_ns.attributes_begin = current_ns.attributes_end = sent.attributes.size();
+    current_ns.index = dictionary.map_namespace(key_buffer);
     current_ns.token_specific_ns = dependent_on_index;
 }
 
 
-weight_t VwSentenceReader::get_number_or_default(string::const_iterator str_pos, string::const_iterator colon_pos) {
+weight_t VwSentenceReader::get_number_or_default(const char *value_begin, const char *value_end) {
     // Interpret the remainder of the feature as a numeric value.
-    // We do this the C-way to avoid making temporary strings for std::stof.
-    // Premature optimization?
     weight_t val;
-    char *next_char = nullptr;
-    val = strtof(&(*colon_pos) + 1, &next_char);
-//    cerr << "Read val of " << val << "\n";
-    if (next_char != &(*str_pos) || errno != 0) {
-        cerr << "Conversion failed. Falling back to default value (1.0): " << string(colon_pos + 1, str_pos) << "\n";
+    if (!parse_float(value_begin, value_end, val)) {
+        cerr << "Conversion failed. Falling back to default value (1.0): " << string(value_begin, value_end) << "\n";
         val = 1;
     }
     return val;
 }
 
 
-class ArcConstraintLineParser {
-
+TokenId VwSentenceReader::add_token_id(const char *begin, const char *end) {
+    TokenId id;
+    id.length = static_cast<uint32_t>(end - begin);
+    if (mapped_file) {
+        // The identifier is already part of the sentence's text
+        id.offset = static_cast<uint32_t>(begin - sentence_begin);
+    } else {
+        id.offset = static_cast<uint32_t>(sentence_text.size());
+        sentence_text.append(begin, end);
+    }
+    return id;
+}
 
-    std::vector<ArcConstraint> parse_line(string &line) {
-        std::vector<ArcConstraint> constraints;
-        std::stringstream ss(line);
 
+namespace {
+
+// Pages behind the scanner are released in steps of this size
+const size_t release_step = 64 << 20;
+
+// Files are only split into chunks of at least this size for reading on several threads
+const size_t min_chunk_size = 1 << 20;
+
+// Splits [begin, end) into at most `max_chunks` ranges of similar size. Each range but the last ends just after
+// a blank line, so no sentence crosses a range boundary.
+vector<pair<const char *, const char *>> split_at_sentence_boundaries(const char *begin, const char *end,
+                                                                       size_t max_chunks) {
+    size_t size = end - begin;
+    size_t num_chunks = std::max<size_t>(1, std::min(max_chunks, size / min_chunk_size));
+
+    vector<pair<const char *, const char *>> chunks;
+    const char *chunk_begin = begin;
+    for (size_t i = 1; i < num_chunks; i++) {
+        const char *pos = std::max(chunk_begin, begin + size / num_chunks * i);
+        const char *boundary = end;
+        while (pos < end) {
+            auto newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+            if (newline == nullptr || newline + 1 == end)
+                break;
+            if (newline[1] == '\n') {
+                boundary = newline + 2;
+                break;
+            }
+            pos = newline + 1;
+        }
+        if (boundary == end)
+            break;
+        chunks.emplace_back(chunk_begin, boundary);
+        chunk_begin = boundary;
+    }
+    chunks.emplace_back(chunk_begin, end);
+    return chunks;
+}
 
+}
 
 
-        return constraints;
-    };
-};
+vector<Sentence> VwSentenceReader::read(size_t num_threads) {
+    mapped_file = std::make_shared<MappedFile>(filename);
+    const char *begin = mapped_file->data();
+    auto chunks = split_at_sentence_boundaries(begin, begin + mapped_file->size(), num_threads);
 
+    vector<Sentence> corpus;
+    try {
+        if (chunks.size() == 1)
+            read_lines(begin, begin + mapped_file->size(), corpus);
+        else
+            read_chunks(chunks, corpus);
+    } catch (...) {
+        mapped_file.reset();
+        throw;
+    }
 
-vector<Sentence> VwSentenceReader::read() {
-    std::ifstream infile(filename);
-    if (!infile.good())
-        throw std::runtime_error("File " + filename + " cannot be read");
+    mapped_file.reset();
+    return corpus;
+}
 
-    corpus.clear();
-    line_no = 1;
+void VwSentenceReader::read_lines(const char *begin, const char *end, vector<Sentence> &corpus) {
+    line_no = 0;
+    reset_sentence();
 
-    string line;
+    Sentence sentence;
     try {
-        while (std::getline(infile, line)) {
-            if (line.size() == 0 && sent.tokens.size() > 0) {
-                finish_sentence();
-            } else {
-                // End line with a blank character
-                line.push_back(' ');
+        const char *pos = begin;
+        const char *released_up_to = begin;
+        while (pos < end) {
+            auto newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+            const char *line_end = newline != nullptr ? newline : end;
 
-                if (line[0] == '#') {
-                    parse_constraint(line.cbegin() + 1, line.cend());
-                } else {
-                    parse_instance(line.cbegin(), line.cend());
-                }
+            line_no++;
+            if (parse_line(pos, line_end, sentence))
+                corpus.push_back(std::move(sentence));
+
+            pos = newline != nullptr ? newline + 1 : end;
+            if (static_cast<size_t>(pos - released_up_to) >= release_step) {
+                mapped_file->release(released_up_to, pos);
+                released_up_to = pos;
+            }
+        }
 
+        if (sent.tokens.size() > 0) {
+            finish_sentence(sentence);
+            corpus.push_back(std::move(sentence));
+        }
+    } catch (input_parse_error &e) {
+        e.line_no = line_no;
+        e.filename = filename;
+        reset_sentence();
+        throw;
+    }
+}
 
+void VwSentenceReader::read_chunks(const vector<pair<const char *, const char *>> &chunks,
+                                   vector<Sentence> &corpus) {
+    // Each chunk is read with a dictionary of its own
+    struct Chunk {
+        CorpusDictionary dictionary;
+        vector<Sentence> sentences;
+        size_t num_lines = 0;
+        std::exception_ptr error;
+    };
+    vector<Chunk> results(chunks.size());
+
+    vector<std::thread> threads;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        threads.emplace_back([this, &chunks, &results, i]() {
+            auto &result = results[i];
+            VwSentenceReader chunk_reader(filename, result.dictionary);
+            chunk_reader.mapped_file = mapped_file;
+            try {
+                chunk_reader.read_lines(chunks[i].first, chunks[i].second, result.sentences);
+            } catch (...) {
+                result.error = std::current_exception();
+            }
+            result.num_lines = chunk_reader.line_no;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    // Report the error a sequential read would have stopped at, with its line number in the whole file
+    size_t first_line = 0;
+    for (auto &result : results) {
+        if (result.error) {
+            try {
+                std::rethrow_exception(result.error);
+            } catch (input_parse_error &e) {
+                e.line_no += first_line;
+                throw;
             }
+        }
+        first_line += result.num_lines;
+    }
+
+    // Add the entries of the chunk dictionaries to the shared one in chunk order and in the order they were first
+    // seen within each chunk. This is the order of a sequential read, so all ids come out the same.
+    vector<DictionaryIdMap> id_maps;
+    for (auto &result : results)
+        id_maps.push_back(dictionary.merge(result.dictionary));
+
+    // Translate the ids of each chunk
+    threads.clear();
+    for (size_t i = 0; i < results.size(); i++) {
+        threads.emplace_back([&results, &id_maps, i]() {
+            for (auto &sentence : results[i].sentences)
+                id_maps[i].apply(sentence);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    size_t num_sentences = 0;
+    for (auto &result : results)
+        num_sentences += result.sentences.size();
+    corpus.reserve(corpus.size() + num_sentences);
+    for (auto &result : results)
+        std::move(result.sentences.begin(), result.sentences.end(), std::back_inserter(corpus));
+}
+
+bool VwSentenceReader::read_sentence(std::istream &in, Sentence &sentence) {
+    string line;
+    try {
+        while (std::getline(in, line)) {
             line_no++;
+            if (parse_line(line.data(), line.data() + line.size(), sentence))
+                return true;
         }
 
-        if (sent.tokens.size() > 0)
-            finish_sentence();
+        if (sent.tokens.size() > 0) {
+            finish_sentence(sentence);
+            return true;
+        }
 
-    } catch (input_parse_error *e) {
-        e->line_no = line_no;
-        e->filename = filename;
-        throw e;
+    } catch (input_parse_error &e) {
+        e.line_no = line_no;
+        e.filename = filename;
+
+        // Drop the partial sentence, and skip to the blank line that ends it
+        reset_sentence();
+        if (!line.empty()) {
+            while (std::getline(in, line)) {
+                line_no++;
+                if (line.empty())
+                    break;
+            }
+        }
+        throw;
     }
 
-    return corpus;
+    return false;
+}
+
+bool VwSentenceReader::parse_line(const char *begin, const char *end, Sentence &sentence) {
+    if (begin == end && sent.tokens.size() > 0) {
+        finish_sentence(sentence);
+        return true;
+    }
+
+    line_begin = begin;
+    if (sentence_begin == nullptr)
+        sentence_begin = begin;
 
+    if (begin != end && *begin == '#') {
+        parse_constraint(begin + 1, end);
+    } else {
+        parse_instance(begin, end);
+    }
+    return false;
 }
 
-void VwSentenceReader::finish_sentence() {
-    // Add the artificial root content to the end of the sentence
+void VwSentenceReader::finish_sentence(Sentence &sentence) {
+    // Add the artificial root content to the end of the sentence. It has no identifier.
     sent.tokens.emplace_back();
     auto &root_token = sent.tokens.back();
-    root_token.id = "root";
     root_token.head = -2;
     root_token.label = dictionary.map_label("root");
+    root_token.namespaces_begin = root_token.namespaces_end = sent.namespaces.size();
+
+    if (mapped_file) {
+        // Share ownership of the mapping, but point to the sentence
+        sent.text = std::shared_ptr<const char>(mapped_file, sentence_begin);
+    } else {
+        auto owned_text = std::make_shared<string>(std::move(sentence_text));
+        sent.text = std::shared_ptr<const char>(owned_text, owned_text->data());
+    }
 
     // Set the content index
     for (int i = 0; i < sent.tokens.size(); i++)
@@ -251,7 +532,7 @@ void VwSentenceReader::finish_sentence() {
             token.head = root_token.index;
 
         if (token.head >= 0 && token.head >= sent.tokens.size()) {
-            throw new input_parse_error("Token " + token.id + " has a head " +
+            throw input_parse_error("Token " + sent.token_id(token.index) + " has a head " +
                                                 to_string(token.head) + ", which is outside the sentence", 0);
         }
     }
@@ -261,20 +542,91 @@ void VwSentenceReader::finish_sentence() {
     // Check sentence consistency
     assert(sent.tokens.size() >= 2);
 
+    sent.index_namespaces();
+    sent.index_constraints();
 
-    // Add finished sentence to corpus
-    corpus.push_back(sent);
+    sentence = std::move(sent);
+    reset_sentence();
+}
+
+void VwSentenceReader::reset_sentence() {
     sent = Sentence();
+    sentence_begin = nullptr;
+    sentence_text.clear();
+}
+
+PrefetchingSentenceStream::PrefetchingSentenceStream(string filename, CorpusDictionary &dictionary, size_t capacity)
+        : in(filename), reader(filename, dictionary), capacity(std::max<size_t>(capacity, 1)) {
+    if (!in.good())
+        throw std::runtime_error("File " + filename + " cannot be read");
+    thread = std::thread(&PrefetchingSentenceStream::read_all, this);
+}
+
+PrefetchingSentenceStream::~PrefetchingSentenceStream() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    not_full.notify_all();
+    thread.join();
+}
+
+void PrefetchingSentenceStream::read_all() {
+    try {
+        Sentence sentence;
+        while (reader.read_sentence(in, sentence)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [this]() { return stopping || queue.size() < capacity; });
+            if (stopping)
+                break;
+            queue.push_back(std::move(sentence));
+            lock.unlock();
+            not_empty.notify_one();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    not_empty.notify_all();
 }
 
+bool PrefetchingSentenceStream::next(Sentence &storage, const Sentence *&sentence, size_t &index) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return done || !queue.empty(); });
+    if (queue.empty()) {
+        if (error)
+            std::rethrow_exception(error);
+        return false;
+    }
+
+    storage = std::move(queue.front());
+    queue.pop_front();
+    sentence = &storage;
+    index = num_taken++;
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+}
+
+
 const char *input_parse_error::what() const noexcept {
-    std::string msg;
-    msg.append("Input error in file ");
-    msg.append(filename);
-    msg.append(" on line ");
-    msg.append(to_string(line_no));
-    msg.append(": ");
-    msg.append(message);
-
-    return msg.c_str();
+    // The message is kept in the exception, so the returned pointer stays valid
+    what_message.clear();
+    what_message.append("Input error in file ");
+    what_message.append(filename);
+    what_message.append(" on line ");
+    what_message.append(to_string(line_no));
+    if (pos_on_line > 0) {
+        what_message.append(", column ");
+        what_message.append(to_string(pos_on_line));
+    }
+    what_message.append(": ");
+    what_message.append(message);
+
+    return what_message.c_str();
 }
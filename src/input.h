@@ -9,53 +9,115 @@
 #ifndef rungsted_parser_input_h
 #define rungsted_parser_input_h
 
-#include <regex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
 #include "feature_handling.h"
+#include "mapped_file.h"
 
 
 class VwSentenceReader {
 public:
     VwSentenceReader(std::string filename, CorpusDictionary & dictionary);
     VwSentenceReader() = delete;
-    std::vector<Sentence> read();
+    // Reads the whole file. The file is mapped into memory and scanned in place, and the token identifiers
+    // of the sentences point into the mapping, which stays open as long as any of the sentences is alive.
+    // With several threads, the file is split at blank lines into chunks that are read in parallel. The
+    // dictionary ends up with the same ids as with a sequential read.
+    std::vector<Sentence> read(size_t num_threads = 1);
+    // Reads the next sentence from `in`. Returns false at the end of the input.
+    // After an `input_parse_error`, the rest of the offending sentence has been skipped,
+    // so reading can continue with the next one.
+    bool read_sentence(std::istream &in, Sentence &sentence);
 private:
-    void parse_instance(std::string::const_iterator, std::string::const_iterator);
-    void parse_constraint(std::string::const_iterator, std::string::const_iterator);
-    void parse_header(std::string::const_iterator, std::string::const_iterator);
-    void parse_body(std::string::const_iterator, std::string::const_iterator);
-    void finish_sentence();
-    weight_t get_number_or_default(std::string::const_iterator, std::string::const_iterator);
+    // The scanner works directly on the characters of the current line. Positions are pointers into the line.
+    // Returns true if the line ended a sentence, which is then moved to `sentence`.
+    bool parse_line(const char *begin, const char *end, Sentence &sentence);
+    void read_lines(const char *begin, const char *end, std::vector<Sentence> &corpus);
+    void read_chunks(const std::vector<std::pair<const char *, const char *>> &chunks,
+                     std::vector<Sentence> &corpus);
+    void parse_instance(const char *begin, const char *end);
+    void parse_constraint(const char *begin, const char *end);
+    void parse_header(const char *begin, const char *end);
+    void parse_body(const char *begin, const char *end);
+    void finish_sentence(Sentence &sentence);
+    void reset_sentence();
+    TokenId add_token_id(const char *begin, const char *end);
+    weight_t get_number_or_default(const char *value_begin, const char *value_end);
+    // Throws an `input_parse_error` pointing at `pos` on the current line
+    [[noreturn]] void fail(const char *pos, const std::string &message);
     
-//     std::string::const_iterator * error_pos;
     CorpusDictionary & dictionary;
     std::string filename;
-    std::vector<Sentence> corpus;
-    size_t line_no;
-// size_t error_line_pos;
+    size_t line_no = 0;
+    const char *line_begin = nullptr;
     Sentence sent {};
+    // While reading a mapped file: the file, and the first line of the current sentence in it
+    std::shared_ptr<MappedFile> mapped_file;
+    const char *sentence_begin = nullptr;
+    // While reading a stream: the token identifiers of the current sentence
+    std::string sentence_text;
     Token token {};
     
-    std::regex ws_re{"\\s+", std::regex::optimize};
-    std::string ns_name;
-    std::string feature;
+    // Reused for dictionary lookups, so no string is allocated per feature
+    std::string key_buffer;
 
-    int dependent_on_index = -1;
+    void parse_namespace_decl(const char *begin, const char *end);
+    void parse_feature_decl(const char *begin, const char *end);
+};
+
+/**
+ * Reads the sentences of a file on a background thread, which keeps up to `capacity` sentences ready in a queue.
+ * Reading thus overlaps with the work done on the sentences, and only the queued sentences are in memory.
+ *
+ * Reading errors are rethrown by `next` once the sentences before the error have been taken.
+ * The background thread adds to `dictionary`, so it must not be used elsewhere while the stream is open.
+ */
+class PrefetchingSentenceStream : public SentenceStream {
+public:
+    PrefetchingSentenceStream(std::string filename, CorpusDictionary &dictionary, size_t capacity);
+    ~PrefetchingSentenceStream();
+    PrefetchingSentenceStream(const PrefetchingSentenceStream &) = delete;
+    PrefetchingSentenceStream &operator=(const PrefetchingSentenceStream &) = delete;
+
+    bool next(Sentence &storage, const Sentence *&sentence, size_t &index) override;
+
+private:
+    void read_all();
 
+    std::ifstream in;
+    VwSentenceReader reader;
+    size_t capacity;
 
-    void parse_namespace_decl(std::string::const_iterator start_of_token, std::string::const_iterator  str_pos);
-    void parse_feature_decl(std::string::const_iterator start_of_token, std::string::const_iterator str_pos);
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<Sentence> queue;
+    size_t num_taken = 0;
+    bool done = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread thread;
 };
 
 class input_parse_error : public std::exception {
 public:
     input_parse_error(std::string message, size_t pos_on_line) : message(message), pos_on_line(pos_on_line) {}
-    size_t line_no;
+    size_t line_no = 0;
     std::string message;
+    // Column of the error, counting from 1. Zero if the error concerns the line or sentence as a whole.
     size_t pos_on_line;
     std::string filename;
     virtual const char* what() const noexcept override;
 
 private:
+    mutable std::string what_message;
 };
 
 
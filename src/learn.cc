@@ -1,126 +1,337 @@
 #include <random>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include "learn.h"
 #include "feature_handling.h"
 
-void TransitionParser::fit(std::vector<Sentence> &sentences) {
-    std::vector<FeatureKey> features;
+namespace {
 
-    for (int round_i = 0; round_i < num_rounds; round_i++) {
-        int num_updates = 0;
-        int num_tokens_seen = 0;
-        cout << "Pass " << round_i + 1 << " begun\n";
+// Hands out the sentences of a vector in order
+class VectorSentenceStream : public SentenceStream {
+public:
+    VectorSentenceStream(const std::vector<Sentence> &sentences) : sentences(sentences) { }
+
+    bool next(Sentence &, const Sentence *&sentence, size_t &index) override {
+        index = next_index.fetch_add(1);
+        if (index >= sentences.size())
+            return false;
+        sentence = &sentences[index];
+        return true;
+    }
+
+private:
+    const std::vector<Sentence> &sentences;
+    std::atomic<size_t> next_index {0};
+};
 
+}
 
-        for (auto sent : sentences) {
-            auto state = ParseState(sent.tokens.size(), sent.span_constraints.size());
 
-            while (!state.is_terminal()) {
-                num_tokens_seen++;
+void TransitionParser::fit(std::vector<Sentence> &sentences) {
+    fit(sentences.size(), [&sentences]() {
+        return std::unique_ptr<SentenceStream>(new VectorSentenceStream(sentences));
+    });
+}
 
-                // Compute features for the current state,
-                // and score moves according to current model.
-                feature_builder->fill_features(state, sent, features, 0);
-                score_moves(features);
+void TransitionParser::fit(size_t num_sentences, const std::function<std::unique_ptr<SentenceStream>()> &start_pass) {
+    if (frozen)
+        throw std::logic_error("A frozen model cannot be trained");
 
-                // Get the best next move according to current parameters.
-                auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
-                auto oracle_moves = strategy.oracle(state, sent);
-                LabeledMove & pred_move = argmax_move(allowed_moves);
-                LabeledMove & gold_move = argmax_move(oracle_moves);
+    bool use_cache_file = !feature_cache_file.empty();
+    if (use_cache_file && num_threads > 1)
+        throw std::invalid_argument("A feature cache file cannot be used when training with several threads");
 
-                assert(allowed_moves.test(gold_move));
+    std::vector<SentenceFeatureCache> feature_cache(use_feature_cache && !use_cache_file ? num_sentences : 0);
 
-                // If predicted move and gold move are not identical,
-                // update the model with the difference between the
-                // feature representations of the two moves.
-                // EARLY UPDATE
-                if (pred_move != gold_move) {
-                    num_updates++;
-                    do_update(features, pred_move, gold_move);
-                }
+    // With a cache file, pass k reads the recording written in pass k-1 and writes its own to the other file
+    std::string cache_files[2] = {feature_cache_file, feature_cache_file + ".next"};
+    SentenceFeatureCache sentence_cache;
+    std::string record;
+    Sentence storage;
+    const Sentence *sentence;
+    size_t sent_i;
 
-                // TODO Explore errors?
-                if (state.span_states.size() > 0)
-                    update_span_states(gold_move, state, sent);
-                perform_move(gold_move, state, sent.tokens);
-                features.clear();
+    for (size_t round_i = 0; round_i < num_rounds; round_i++) {
+        PassStats stats;
+        cout << "Pass " << round_i + 1 << " begun\n";
+        auto sentences = start_pass();
+
+        if (use_cache_file) {
+            std::unique_ptr<FeatureCacheReader> reader;
+            if (round_i > 0)
+                reader.reset(new FeatureCacheReader(cache_files[(round_i - 1) % 2]));
+            // The recording of the last pass is not needed
+            std::unique_ptr<FeatureCacheWriter> writer;
+            if (round_i + 1 < num_rounds)
+                writer.reset(new FeatureCacheWriter(cache_files[round_i % 2]));
+
+            while (sentences->next(storage, sentence, sent_i)) {
+                if (reader) {
+                    if (!reader->next(record))
+                        throw std::runtime_error("Feature cache " + cache_files[(round_i - 1) % 2] +
+                                                 " has fewer sentences than the training data");
+                    decode_sentence_cache(record, sentence_cache);
+                } else {
+                    sentence_cache.clear();
+                }
 
+                bool changed = fit_sentence(*sentence, &sentence_cache, main_scratch, stats);
+                if (writer) {
+                    if (changed)
+                        writer->write(sentence_cache);
+                    else
+                        writer->write_record(record);
+                }
             }
+        } else if (num_threads > 1) {
+            fit_pass_parallel(*sentences, feature_cache, stats);
+        } else {
+            while (sentences->next(storage, sentence, sent_i))
+                fit_sentence(*sentence, cached_sentence(feature_cache, sent_i), main_scratch, stats);
         }
 
-        double correct_pct = 1.0 - (static_cast<double>(num_updates) / static_cast<double>(num_tokens_seen));
+        double correct_pct = 1.0 - (static_cast<double>(stats.num_updates) / static_cast<double>(stats.num_transitions));
         correct_pct *= 100;
         cout << correct_pct << " % correct decisions in round\n";
+        if (use_feature_cache || use_cache_file)
+            cout << stats.num_replayed << " of " << stats.num_transitions << " transitions replayed from the feature cache\n";
+
+    }
 
+    if (use_cache_file) {
+        std::remove(cache_files[0].c_str());
+        std::remove(cache_files[1].c_str());
     }
 
     finish_learn();
+    freeze();
 }
 
-void TransitionParser::do_update(vector<FeatureKey> &features, LabeledMove &pred_move,
-                                 LabeledMove &gold_move) {
-    weights.num_updates++;
-    for (const auto &feature : features) {
-        // Idea: separate update step to a function
-        auto section = weights.get_or_insert_section(feature);
+SentenceFeatureCache *TransitionParser::cached_sentence(std::vector<SentenceFeatureCache> &feature_cache,
+                                                        size_t sent_i) {
+    if (!use_feature_cache)
+        return nullptr;
+    if (sent_i >= feature_cache.size())
+        throw std::runtime_error("The training data has more sentences than in the first pass");
+    return &feature_cache[sent_i];
+}
 
-        auto *w = section.weights();
-        auto *acc_weights = section.acc_weights();
-        auto *update_timestamp = section.update_timestamps();
+void TransitionParser::fit_pass_parallel(SentenceStream &sentences, std::vector<SentenceFeatureCache> &feature_cache,
+                                         PassStats &stats) {
+    std::vector<PassStats> thread_stats(num_threads);
+    std::vector<std::exception_ptr> thread_errors(num_threads);
+    std::vector<std::thread> threads;
+
+    for (size_t thread_i = 0; thread_i < num_threads; thread_i++) {
+        threads.emplace_back([&, thread_i]() {
+            try {
+                auto scratch = make_scratch();
+                Sentence storage;
+                const Sentence *sentence;
+                size_t sent_i;
+                while (sentences.next(storage, sentence, sent_i)) {
+                    // Growing the weight table waits until no thread is inside a sentence
+                    SharedLockGuard table_guard(*weights.resize_lock);
+                    fit_sentence(*sentence, cached_sentence(feature_cache, sent_i), scratch, thread_stats[thread_i]);
+                }
+            } catch (...) {
+                thread_errors[thread_i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    for (size_t thread_i = 0; thread_i < num_threads; thread_i++) {
+        if (thread_errors[thread_i])
+            std::rethrow_exception(thread_errors[thread_i]);
+        stats.num_transitions += thread_stats[thread_i].num_transitions;
+        stats.num_updates += thread_stats[thread_i].num_updates;
+        stats.num_replayed += thread_stats[thread_i].num_replayed;
+    }
+}
+
+bool TransitionParser::fit_sentence(const Sentence &sent, SentenceFeatureCache *cache, ParserScratch &scratch,
+                                    PassStats &stats) {
+    size_t num_replayed = 0;
+
+    if (cache != nullptr && !cache->transitions.empty()) {
+        // Replay the recorded transitions for as long as the gold moves agree with the recording.
+        // The gold move is the best scoring zero-cost move, so it may change as the weights change.
+        size_t features_begin = 0;
+        bool diverged = false;
+        while (num_replayed < cache->transitions.size() && !diverged) {
+            auto &cached = cache->transitions[num_replayed];
+            auto &gold_move = train_on_transition(&cache->features[features_begin], cached.features_end - features_begin,
+                                                  cached.allowed_moves, cached.oracle_moves, scratch, stats);
+            diverged = gold_move.index != cached.gold_move_index;
+            cached.gold_move_index = gold_move.index;
+            features_begin = cached.features_end;
+            num_replayed++;
+        }
+
+        stats.num_replayed += num_replayed;
+        if (!diverged)
+            return false;
+
+        // The rest of the recording belongs to a different trajectory
+        cache->transitions.resize(num_replayed);
+        cache->features.resize(features_begin);
+    }
 
-        // Perform missed updates on the accumulated weights due to sparse updating
-        float num_missed_updates_pred = weights.num_updates - update_timestamp[pred_move.index] - 1;
-        float num_missed_updates_gold = weights.num_updates - update_timestamp[gold_move.index] - 1;
+    // Bring the parse state up to date with the replayed transitions
+    auto &state = scratch.state;
+    state.reset(sent);
+    for (size_t i = 0; i < num_replayed; i++) {
+        auto &gold_move = labeled_move_list[cache->transitions[i].gold_move_index];
+        if (state.span_states.size() > 0)
+            update_span_states(gold_move, state, sent);
+        perform_move(gold_move, state, sent.tokens);
+    }
+
+    while (!state.is_terminal()) {
+        // Compute features for the current state, and find the allowed and zero-cost moves.
+        auto &features = scratch.features;
+        features.clear();
+        feature_builder->extract(state, sent, features, scratch.feature_scratch);
+        auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
+        auto oracle_moves = strategy.oracle(state, sent);
+
+        auto &gold_move = train_on_transition(features.data(), features.size(), allowed_moves, oracle_moves,
+                                              scratch, stats);
+
+        if (cache != nullptr) {
+            cache->features.insert(cache->features.end(), features.begin(), features.end());
+            cache->transitions.push_back({cache->features.size(), allowed_moves, oracle_moves, gold_move.index});
+        }
 
-        acc_weights[pred_move.index] += num_missed_updates_pred * w[pred_move.index];
-        acc_weights[gold_move.index] += num_missed_updates_gold * w[gold_move.index];
+        // TODO Explore errors?
+        if (state.span_states.size() > 0)
+            update_span_states(gold_move, state, sent);
+        perform_move(gold_move, state, sent.tokens);
+    }
+    return true;
+}
 
-        update_timestamp[pred_move.index] = weights.num_updates;
-        update_timestamp[gold_move.index] = weights.num_updates;
+LabeledMove &TransitionParser::train_on_transition(const FeatureKey *features, size_t num_features,
+                                                   const LabeledMoveSet &allowed_moves,
+                                                   const LabeledMoveSet &oracle_moves, ParserScratch &scratch,
+                                                   PassStats &stats) {
+    stats.num_transitions++;
+
+    // Score moves according to current model,
+    // and get the best next move according to current parameters.
+    score_moves(features, num_features, scratch);
+    LabeledMove & pred_move = argmax_move(allowed_moves, scratch);
+    LabeledMove & gold_move = argmax_move(oracle_moves, scratch);
+
+    assert(allowed_moves.test(gold_move));
+
+    // If predicted move and gold move are not identical,
+    // update the model with the difference between the
+    // feature representations of the two moves.
+    // EARLY UPDATE
+    if (pred_move != gold_move) {
+        stats.num_updates++;
+        do_update(features, num_features, pred_move, gold_move);
+    }
 
-        // Gold
-        w[gold_move.index] += feature.value;
-        acc_weights[gold_move.index] += feature.value;
+    return gold_move;
+}
 
-        // Pred
-        w[pred_move.index] -= feature.value;
-        acc_weights[pred_move.index] -= feature.value;
+void TransitionParser::do_update(const FeatureKey *features, size_t num_features, LabeledMove &pred_move,
+                                 LabeledMove &gold_move) {
+    // Updates are numbered from 1. With several threads they are numbered in the order they start, but may reach
+    // a section out of order. That does not matter for averaging, since every change is recorded with its own
+    // number. A section is updated under a lock, so that two threads do not lose each other's changes.
+    bool concurrent = num_threads > 1;
+    size_t update_number = concurrent ? __atomic_add_fetch(&weights.num_updates, 1, __ATOMIC_RELAXED)
+                                      : ++weights.num_updates;
+
+    for (size_t i = 0; i < num_features; i++) {
+        const auto &feature = features[i];
+        // Idea: separate update step to a function
+        auto section = concurrent ? weights.get_or_insert_section_concurrent(feature)
+                                  : weights.get_or_insert_section(feature);
+        std::unique_lock<std::mutex> section_guard;
+        if (concurrent)
+            section_guard = std::unique_lock<std::mutex>(weights.section_lock(feature));
+
+        section.add(gold_move.index, feature.value, update_number);
+        section.add(pred_move.index, -feature.value, update_number);
     }
 }
 
 void TransitionParser::finish_learn() {
+    if (weights.num_updates == 0)
+        return;
+
     // FIXME Average weights in a hacky way that exposes details of the hash table better left unexposed.
-    for (size_t key : weights.table_block.keys) {
-        if (key != 0) {
-            auto section = weights.get_section(key);
+    auto &table = weights.table_block;
+    for (size_t cell_i = 0; cell_i < table.num_cells(); cell_i++) {
+        if (table.key_at(cell_i) != 0) {
+            auto section = WeightSectionWrap(table.values_at(cell_i), weights.aligned_section_size);
             auto *w = section.weights();
+            for (int i = 0; i < weights.section_size; i++)
+                w[i] = section.average(i, weights.num_updates);
+        }
+    }
+}
 
-            auto *acc_weights = section.acc_weights();
-            auto *update_timestamps = section.update_timestamps();
-
-            for (int i = 0; i < weights.section_size; i++) {
-                if (update_timestamps[i] == 0)
-                    continue;
-
-                // Add missed updates to acc_weights
-                float num_missed_updates = (weights.num_updates - update_timestamps[i]);
-                acc_weights[i] += w[i] * num_missed_updates;
-                w[i] = acc_weights[i] / weights.num_updates;
+void TransitionParser::freeze() {
+    auto &table = weights.table_block;
+    std::vector<size_t> keys;
+    std::vector<weight_t> values;
+    size_t num_dropped = 0;
+
+    for (size_t cell_i = 0; cell_i < table.num_cells(); cell_i++) {
+        if (table.key_at(cell_i) != 0) {
+            const auto *w = WeightSectionWrap(table.values_at(cell_i), weights.aligned_section_size).weights();
+            if (std::all_of(w, w + num_labeled_moves, [](weight_t val) { return val == 0; })) {
+                num_dropped++;
+            } else {
+                keys.push_back(table.key_at(cell_i));
+                values.insert(values.end(), w, w + weights.aligned_section_size);
             }
         }
     }
+
+    size_t training_memory = table.memory_usage();
+    frozen_weights = StaticHashTableBlock(keys, values, weights.aligned_section_size);
+    // Release the training table
+    weights = WeightMap();
+    frozen = true;
+
+    cout << "Frozen model has " << frozen_weights.num_entries() << " sections (" << num_dropped << " all-zero dropped), ";
+    cout << frozen_weights.memory_usage() / (1 << 20) << " MB down from " << training_memory / (1 << 20) << " MB\n";
+}
+
+void TransitionParser::save(const std::string &filename) {
+    if (!frozen)
+        freeze();
+    write_model_file(filename, corpus_dictionary, feature_builder->template_text, frozen_weights, num_labeled_moves);
 }
 
 ParseResult TransitionParser::parse(const Sentence &sent) {
-    std::vector<FeatureKey> features;
-    auto state = ParseState(sent.tokens.size(), sent.span_constraints.size());
+    return parse(sent, main_scratch);
+}
+
+ParseResult TransitionParser::parse(const Sentence &sent, ParserScratch &scratch) {
+    auto &features = scratch.features;
+    features.clear();
+    auto &state = scratch.state;
+    state.reset(sent.tokens.size(), sent.span_constraints);
 
     while (!state.is_terminal()) {
-        feature_builder->fill_features(state, sent, features, 0);
-        score_moves(features);
+        feature_builder->extract(state, sent, features, scratch.feature_scratch);
+        score_moves(features.data(), features.size(), scratch);
         auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
 
-        LabeledMove & pred_move = argmax_move(allowed_moves);
+        LabeledMove & pred_move = argmax_move(allowed_moves, scratch);
 
         if (state.span_states.size() > 0)
             update_span_states(pred_move, state, sent);
@@ -130,47 +341,77 @@ ParseResult TransitionParser::parse(const Sentence &sent) {
         features.clear();
     }
 
-    return ParseResult(state.heads, state.labels);
+    ParseResult result;
+    result.heads = state.heads;
+    result.labels = state.labels;
+    return result;
 };
 
-
-void TransitionParser::score_moves(std::vector<FeatureKey> &features) {
-    std::fill(scores.begin(), scores.end(), 0);
-
-    for (FeatureKey &feature : features) {
-        auto section = weights.get_or_insert_section(feature);
-        auto *w = section.weights();
-
-        for (int move_id = 0; move_id < num_labeled_moves; move_id++) {
-            scores[move_id] += w[move_id];
+void TransitionParser::parse_batch(const Sentence *sentences, size_t num_sentences, ParseResult *results,
+                                   size_t num_threads, ParseScore *score) {
+    const size_t chunk_size = 16;
+    size_t next_sentence = 0;
+    std::vector<ParseScore> thread_scores(num_threads);
+    std::vector<std::exception_ptr> thread_errors(num_threads);
+
+    auto work = [&](size_t thread_i) {
+        try {
+            auto scratch = make_scratch();
+            size_t begin;
+            while ((begin = __atomic_fetch_add(&next_sentence, chunk_size, __ATOMIC_RELAXED)) < num_sentences) {
+                size_t end = std::min(begin + chunk_size, num_sentences);
+                for (size_t sent_i = begin; sent_i < end; sent_i++) {
+                    results[sent_i] = parse(sentences[sent_i], scratch);
+                    if (score != nullptr)
+                        sentences[sent_i].score(results[sent_i], thread_scores[thread_i]);
+                }
+            }
+        } catch (...) {
+            thread_errors[thread_i] = std::current_exception();
         }
+    };
+
+    // The calling thread is one of the workers
+    std::vector<std::thread> threads;
+    for (size_t thread_i = 1; thread_i < num_threads; thread_i++)
+        threads.emplace_back(work, thread_i);
+    work(0);
+    for (auto &thread : threads)
+        thread.join();
+
+    for (size_t thread_i = 0; thread_i < num_threads; thread_i++) {
+        if (thread_errors[thread_i])
+            std::rethrow_exception(thread_errors[thread_i]);
+        if (score != nullptr)
+            score->add(thread_scores[thread_i]);
     }
 }
 
-LabeledMove TransitionParser::predict_move() {
-    return labeled_move_list[argmax(scores)];
+
+ParserScratch TransitionParser::make_scratch() const {
+    ParserScratch scratch;
+    scratch.scores.resize(padded_row_size(num_labeled_moves));
+    return scratch;
 }
 
-LabeledMove TransitionParser::compute_gold_move(Sentence &sent, ParseState &state) {
-    // Get zero cost moves.
-    LabeledMoveSet zero_cost_labeled_moves = strategy.oracle(state, sent);
-
-    weight_t best_score = -std::numeric_limits<weight_t>::infinity();
-    LabeledMove *gold_move_ptr = nullptr;
-    for (int i = 0; i < num_labeled_moves; i++) {
-        auto &current = labeled_move_list[i];
-        if (zero_cost_labeled_moves.test(current) && scores[i] >= best_score) {
-            best_score = scores[i];
-            gold_move_ptr = &current;
-        }
-    }
+void TransitionParser::score_moves(const FeatureKey *features, size_t num_features, ParserScratch &scratch) {
+    auto &scores = scratch.scores;
+    std::fill(scores.begin(), scores.end(), 0);
 
-    assert(gold_move_ptr != nullptr);
-    return *gold_move_ptr;
+    for (size_t i = 0; i < num_features; i++) {
+        const auto &feature = features[i];
+        // Features without a section have all-zero weights and contribute nothing
+        const auto *w = frozen ? frozen_weights.lookup(feature.hashed_val) : weights.find_weights(feature);
+        if (w == nullptr)
+            continue;
+
+        accumulate_row(scores.data(), w, scores.size(), feature.value);
+    }
 }
 
 
-LabeledMove & TransitionParser::argmax_move(LabeledMoveSet &allowed) {
+LabeledMove & TransitionParser::argmax_move(const LabeledMoveSet &allowed, const ParserScratch &scratch) {
+    const auto &scores = scratch.scores;
     weight_t best_val = -std::numeric_limits<weight_t>::infinity();
     int best_index = -1;
 
@@ -209,43 +450,64 @@ std::ostream& operator <<(std::ostream& os, const Move& move) {
 
 
 void update_span_states(const LabeledMove &lmove, ParseState &state, const Sentence &sent) {
-    for (size_t i = 0; i < sent.span_constraints.size(); i++) {
-        auto &span_state = state.span_states.at(i);
-        auto &sc = sent.span_constraints.at(i);
-        auto &stack = state.stack;
-
-//        if (lmove.move == Move::LEFT_ARC && sc.is_inside(state.n0) && sc.is_inside(stack.back())) {
-//            assert(span_state.num_connected_components >= 1);
-//        }
-
-        switch (lmove.move) {
-            case Move::SHIFT:
-                // A node of the span is shifted onto the stack
-                if (sc.is_inside(state.n0))
-                    span_state.num_connected_components += 1;
-                break;
-            case Move::RIGHT_ARC:
-                // The first node of the span is inserted into the stack
-                if (sc.span_start == state.n0)
-                    span_state.num_connected_components = 1;
-                break;
-            case Move::LEFT_ARC:
-                // Two nodes of the span become connected
-                if (sc.is_inside(state.n0) && sc.is_inside(stack.back()))
-                    span_state.num_connected_components -= 1;
-                break;
-            case Move::REDUCE:
-                break;
-            default:
-                throw std::runtime_error("Invalid move");
-        }
+    if (sent.span_constraints.empty())
+        return;
+    assert(sent.span_constraints_by_token.begin.size() == sent.tokens.size() + 1);
+    auto &stack = state.stack;
+    const token_index_t s0 = stack.empty() ? -1 : stack.back();
+
+    // A move only changes the spans that contain S0 or N0. Those that contain both are updated with S0.
+    for (auto token : {s0, state.n0}) {
+        if (token == -1)
+            continue;
+        auto span_range = sent.span_constraints_by_token.of(token);
+        for (auto c = span_range.first; c != span_range.second; c++) {
+            auto &span_state = state.span_states.at(*c);
+            auto &sc = sent.span_constraints.at(*c);
+            if (token == state.n0 && sc.is_inside(s0))
+                continue;
+
+//            if (lmove.move == Move::LEFT_ARC && sc.is_inside(state.n0) && sc.is_inside(stack.back())) {
+//                assert(span_state.num_connected_components >= 1);
+//            }
+
+            switch (lmove.move) {
+                case Move::SHIFT:
+                    // A node of the span is shifted onto the stack
+                    if (sc.is_inside(state.n0)) {
+                        span_state.num_connected_components += 1;
+                        if (state.heads[state.n0] == -1)
+                            span_state.headless_nodes_in_stack += 1;
+                    }
+                    break;
+                case Move::RIGHT_ARC:
+                    // The first node of the span is inserted into the stack. N0 gets a head before it is pushed.
+                    if (sc.span_start == state.n0)
+                        span_state.num_connected_components = 1;
+                    break;
+                case Move::LEFT_ARC:
+                    // Two nodes of the span become connected
+                    if (sc.is_inside(state.n0) && sc.is_inside(stack.back()))
+                        span_state.num_connected_components -= 1;
+                    // S0 gets a head and is popped
+                    if (sc.is_inside(stack.back()) && state.heads[stack.back()] == -1)
+                        span_state.headless_nodes_in_stack -= 1;
+                    break;
+                case Move::REDUCE:
+                    if (sc.is_inside(stack.back()) && state.heads[stack.back()] == -1)
+                        span_state.headless_nodes_in_stack -= 1;
+                    break;
+                default:
+                    throw std::runtime_error("Invalid move");
+            }
 
 
-        if (lmove.move == Move::RIGHT_ARC || lmove.move == Move::LEFT_ARC) {
-            bool s0_inside = sc.is_inside(stack.back());
-            bool n0_inside = sc.is_inside(state.n0);
-            if ((s0_inside && !n0_inside) || (!s0_inside && n0_inside )) {
-                span_state.designated_root = s0_inside ? stack.back() : state.n0;
+            if (lmove.move == Move::RIGHT_ARC || lmove.move == Move::LEFT_ARC) {
+                bool s0_inside = sc.is_inside(stack.back());
+                bool n0_inside = sc.is_inside(state.n0);
+                if ((s0_inside && !n0_inside) || (!s0_inside && n0_inside )) {
+                    span_state.designated_root = s0_inside ? stack.back() : state.n0;
+                }
             }
         }
     }
@@ -255,7 +517,7 @@ ParseResult random_parse(const Sentence &sent, TransitionSystem &strategy, bool
     std::random_device rd;
     std::mt19937 g(rd());
 
-    auto state = ParseState(sent.tokens.size(), sent.span_constraints.size());
+    auto state = ParseState(sent.tokens.size(), sent.span_constraints);
 
     auto possible_moves = strategy.moves(1);
     while (!state.is_terminal()) {
@@ -9,8 +9,14 @@
 #include "feature_handling.h"
 #include "features.h"
 #include "feature_combiner.h"
+#include "model_file.h"
+#include "score_kernel.h"
+#include "aligned_allocator.h"
+#include "feature_cache.h"
 #include <vector>
 #include <numeric>
+#include <functional>
+#include <memory>
 
 using namespace std;
 
@@ -32,6 +38,17 @@ size_t argmax(T container) {
 }
 
 
+// Buffers used while extracting features and scoring moves. Every thread that trains or parses needs its own.
+struct ParserScratch {
+    // Padded to the SIMD width. Scores beyond the number of moves stay zero.
+    aligned_vector<weight_t> scores;
+    std::vector<FeatureKey> features;
+    FeatureProgramScratch feature_scratch;
+    // Reset for each sentence, so that its vectors are allocated once per thread rather than once per sentence
+    ParseState state;
+};
+
+
 class TransitionParser {
 public:
     TransitionParser() = default;
@@ -44,36 +61,108 @@ public:
         labeled_move_list = strategy.moves(corpus_dictionary.label_to_id.size());
         num_labeled_moves = labeled_move_list.size();
         weights = WeightMap(num_labeled_moves);
-        scores.resize(num_labeled_moves);
+        main_scratch = make_scratch();
+    }
+
+    // Parser with frozen weights from a trained model, e.g. one loaded with `read_model_file`.
+    // `num_trained_moves` is the number of moves the model was trained with. The moves rebuilt from `dict` must
+    // match it, or the weight rows would be read with the wrong move order.
+    TransitionParser(CorpusDictionary &dict, std::unique_ptr<UnionList> &feature_builder_, TransitionSystem &strategy_,
+                     StaticHashTableBlock &&frozen_weights_, size_t num_trained_moves)
+            : corpus_dictionary(dict), feature_builder(std::move(feature_builder_)),
+              frozen_weights(std::move(frozen_weights_)), frozen(true), strategy(strategy_) {
+
+        labeled_move_list = strategy.moves(corpus_dictionary.label_to_id.size());
+        num_labeled_moves = labeled_move_list.size();
+        if (num_labeled_moves != num_trained_moves || frozen_weights.stride() != padded_row_size(num_labeled_moves))
+            throw std::runtime_error("Model was trained with " + std::to_string(num_trained_moves) +
+                                     " moves, but the dictionary gives " + std::to_string(num_labeled_moves));
+        main_scratch = make_scratch();
     }
 
+    // Trains the model and freezes it. A frozen model cannot be trained further.
     void fit(std::vector<Sentence> &sentences);
 
+    // Trains on `num_sentences` sentences that need not be in memory at once. `start_pass` is called at the start
+    // of every pass and returns a stream over the training sentences, always in the same order.
+    void fit(size_t num_sentences, const std::function<std::unique_ptr<SentenceStream>()> &start_pass);
+
+    // Keep the features and move sets of every training transition in memory after the first pass.
+    bool use_feature_cache = false;
+
+    // Keep the feature cache in a file with this name instead of in memory. Each pass streams the
+    // recording from one file and writes the updated recording to a second file (with a ".next" suffix).
+    // Both files are removed when training ends.
+    std::string feature_cache_file;
+
+    // Train with this many threads. Each thread takes the next sentence when it is done with the last, and all
+    // threads update the shared weights without waiting for each other (Hogwild). Results then depend on scheduling.
+    // Cannot be combined with `feature_cache_file`.
+    size_t num_threads = 1;
+
+    // Replaces the training weight table by a compact read-only table holding only the averaged weights.
+    // All-zero sections are dropped.
+    void freeze();
+
+    // Saves the frozen weights together with the dictionary and feature template.
+    void save(const std::string &filename);
+
     ParseResult parse(const Sentence &);
 
+    // Parses with the given scratch buffers instead of the parser's own. Any number of threads may parse at once,
+    // each with its own scratch, as long as the model is not being trained.
+    ParseResult parse(const Sentence &, ParserScratch &scratch);
+    ParserScratch make_scratch() const;
+
+    // Parses `num_sentences` sentences with `num_threads` threads, and stores the parse of `sentences[i]`
+    // in `results[i]`. Threads take sentences in small chunks from a shared counter, so uneven sentence
+    // lengths do not leave threads idle. If `score` is given, each thread scores its parses against the
+    // gold trees, and the totals of all threads are added to it.
+    void parse_batch(const Sentence *sentences, size_t num_sentences, ParseResult *results, size_t num_threads,
+                     ParseScore *score = nullptr);
+
 private:
-    void score_moves(std::vector<FeatureKey> &features);
+    struct PassStats {
+        size_t num_transitions = 0;
+        size_t num_updates = 0;
+        size_t num_replayed = 0;
+    };
+
+    // Trains with `num_threads` threads, which take sentences from the stream as they go
+    void fit_pass_parallel(SentenceStream &sentences, std::vector<SentenceFeatureCache> &feature_cache,
+                           PassStats &stats);
+
+    // The in-memory recording of sentence `sent_i`, or null if there is no in-memory feature cache
+    SentenceFeatureCache *cached_sentence(std::vector<SentenceFeatureCache> &feature_cache, size_t sent_i);
+
+    // Returns true if the recording in `cache` was changed
+    bool fit_sentence(const Sentence &sent, SentenceFeatureCache *cache, ParserScratch &scratch, PassStats &stats);
 
-    LabeledMove predict_move();
+    LabeledMove &train_on_transition(const FeatureKey *features, size_t num_features,
+                                     const LabeledMoveSet &allowed_moves, const LabeledMoveSet &oracle_moves,
+                                     ParserScratch &scratch, PassStats &stats);
 
-    LabeledMove compute_gold_move(Sentence &sent, ParseState &state);
+    void score_moves(const FeatureKey *features, size_t num_features, ParserScratch &scratch);
 
     // Reference or copy?
     CorpusDictionary &corpus_dictionary;
     size_t num_rounds = 5;
     WeightMap weights;
     std::unique_ptr<UnionList> feature_builder;
+    StaticHashTableBlock frozen_weights;
+    bool frozen = false;
 
     std::vector<LabeledMove> labeled_move_list;
     size_t num_labeled_moves = 0;
-    std::vector<weight_t> scores;
+    // Used by single-threaded training and by `parse`
+    ParserScratch main_scratch;
     TransitionSystem &strategy;
 
-    void do_update(vector<FeatureKey> &features, LabeledMove &pred_move, LabeledMove &gold_move);
+    void do_update(const FeatureKey *features, size_t num_features, LabeledMove &pred_move, LabeledMove &gold_move);
 
     void finish_learn();
 
-    LabeledMove &argmax_move(LabeledMoveSet &allowed);
+    LabeledMove &argmax_move(const LabeledMoveSet &allowed, const ParserScratch &scratch);
 
 };
 
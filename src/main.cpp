@@ -5,51 +5,47 @@
 #include <algorithm>
 #include "hashtable_block.h"
 #include "feature_set_parser.h"
+#include "server.h"
+#include "corpus_cache.h"
 
 #include <boost/program_options.hpp>
 #include <fstream>
 #include <iomanip>
+#include <unistd.h>
 
 
 using namespace std;
 
+// Sentences read ahead of training when the training file is streamed
+const size_t training_prefetch_size = 1024;
+
 int count_arc_constraints(std::vector<Sentence> &sentences) {
     return std::accumulate(sentences.cbegin(), sentences.cend(), 0,
-                    [](int sum, const Sentence &sent) { return sent.arc_constraints.size();} );
+                    [](int sum, const Sentence &sent) { return sum + sent.arc_constraints.size();} );
 };
 
 int count_span_constraints(std::vector<Sentence> &sentences) {
     return std::accumulate(sentences.cbegin(), sentences.cend(), 0,
-                           [](int sum, const Sentence &sent) { return sent.span_constraints.size();} );
+                           [](int sum, const Sentence &sent) { return sum + sent.span_constraints.size();} );
 };
 
 
 
-void train_test_parser(string data_file, string eval_file, string pred_file, string template_file, int num_passes) {
-    // Read corpus
-    auto dict = CorpusDictionary {};
-    auto train_sents = VwSentenceReader(data_file, dict).read();
-    auto test_sents  = VwSentenceReader(eval_file, dict).read();
-    cerr << "Data set loaded\n";
-    cerr << "\tTrain:" << train_sents.size() << " sentences\n";
-    cerr << "\tTest:" << test_sents.size() << " sentences\n";
-
-    cerr << "Using " << num_passes << " passes\n";
-
-    // Read features
-    auto feature_set = read_feature_file(template_file, dict);
-    cerr << "Using feature definition:\n";
-    cerr << feature_set->name << "\n";
+// Reads a corpus file, through a cache file next to it if `use_cache` is set
+std::vector<Sentence> read_corpus(const string &filename, CorpusDictionary &dict, size_t num_threads, bool use_cache) {
+    if (use_cache)
+        return read_with_corpus_cache(filename, filename + ".cache", dict, num_threads);
+    return VwSentenceReader(filename, dict).read(num_threads);
+}
 
-    // Strategy
+std::unique_ptr<TransitionSystem> make_strategy(int num_arc_constraints_train, int num_span_constraints_train,
+                                                std::vector<Sentence> &test_sents) {
     std::unique_ptr<TransitionSystem> strategy(new ArcEager());
 
 //    TransitionSystem *strategy = new ArcEager();
 
     // Check if any constraints are specified
-    auto num_arc_constraints_train = count_arc_constraints(train_sents);
     auto num_arc_constraints_test = count_arc_constraints(test_sents);
-    auto num_span_constraints_train = count_span_constraints(train_sents);
     auto num_span_constraints_test = count_span_constraints(test_sents);
 //
     if (num_arc_constraints_train + num_arc_constraints_test + num_span_constraints_train + num_span_constraints_test > 0) {
@@ -59,10 +55,16 @@ void train_test_parser(string data_file, string eval_file, string pred_file, str
         cerr << "Span constraints (train: " << num_span_constraints_train << ", test: " << num_span_constraints_test << ").\n";
     }
 
-    auto parser = TransitionParser(dict, feature_set, *strategy, num_passes);
-    parser.fit(train_sents);
+    return strategy;
+}
+
+std::unique_ptr<TransitionSystem> make_strategy(std::vector<Sentence> &train_sents, std::vector<Sentence> &test_sents) {
+    return make_strategy(count_arc_constraints(train_sents), count_span_constraints(train_sents), test_sents);
+}
+
 
-    ParseResult parsed_sentence;
+void evaluate_parser(TransitionParser &parser, std::vector<Sentence> &test_sents, CorpusDictionary &dict, string pred_file,
+                     size_t num_threads) {
     auto id_to_label = invert_map(dict.label_to_id);
 
     std::ofstream ofs;
@@ -75,17 +77,20 @@ void train_test_parser(string data_file, string eval_file, string pred_file, str
         ofs.open("/dev/null");
     }
 
-    bool first_sent = true;
+    // Sentences are parsed in blocks by all threads. Each block is written out in input order
+    // before the next one is parsed, so memory use does not grow with the size of the test set.
+    const size_t block_size = 1024 * num_threads;
+    std::vector<ParseResult> parsed_block(std::min(block_size, test_sents.size()));
     ParseScore parse_score {};
-    for (const auto & sent : test_sents) {
-        if (first_sent)
-            first_sent = false;
-        else
-            ofs << "\n";
-
-        parsed_sentence = parser.parse(sent);
-        output_parse_result(ofs, sent, parsed_sentence, id_to_label);
-        sent.score(parsed_sentence, parse_score);
+    for (size_t block_begin = 0; block_begin < test_sents.size(); block_begin += block_size) {
+        size_t num_in_block = std::min(block_size, test_sents.size() - block_begin);
+        parser.parse_batch(&test_sents[block_begin], num_in_block, parsed_block.data(), num_threads, &parse_score);
+
+        for (size_t i = 0; i < num_in_block; i++) {
+            if (block_begin + i > 0)
+                ofs << "\n";
+            output_parse_result(ofs, test_sents[block_begin + i], parsed_block[i], id_to_label);
+        }
     }
 
     cerr << "Test set results (" << test_sents.size() << " sentences" << ")\n";
@@ -93,8 +98,102 @@ void train_test_parser(string data_file, string eval_file, string pred_file, str
     cerr << " = "  << (parse_score.uas() * 100) << "\n";
     cerr << "   LAS: " << parse_score.num_correct_labeled << "/" << parse_score.num_total;
     cerr << " = " << (parse_score.las() * 100) << "\n";
+}
+
+
+void train_test_parser(string data_file, string eval_file, string pred_file, string template_file, int num_passes,
+                       string model_file, bool use_feature_cache, string feature_cache_file, size_t num_threads,
+                       bool stream_training, bool use_corpus_cache) {
+    // Read corpus. A streamed training file is read once up front to fill the dictionary and count the sentences,
+    // so that ids come out as if the file had been read into memory.
+    auto dict = CorpusDictionary {};
+    std::vector<Sentence> train_sents;
+    size_t num_train_sents = 0;
+    int num_arc_constraints_train = 0;
+    int num_span_constraints_train = 0;
+    if (stream_training) {
+        PrefetchingSentenceStream sentences(data_file, dict, training_prefetch_size);
+        Sentence storage;
+        const Sentence *sentence;
+        size_t sent_i;
+        while (sentences.next(storage, sentence, sent_i)) {
+            num_train_sents++;
+            num_arc_constraints_train += sentence->arc_constraints.size();
+            num_span_constraints_train += sentence->span_constraints.size();
+        }
+    } else {
+        train_sents = read_corpus(data_file, dict, num_threads, use_corpus_cache);
+        num_train_sents = train_sents.size();
+        num_arc_constraints_train = count_arc_constraints(train_sents);
+        num_span_constraints_train = count_span_constraints(train_sents);
+    }
+
+    std::vector<Sentence> test_sents;
+    if (eval_file.size() > 0)
+        test_sents = read_corpus(eval_file, dict, num_threads, use_corpus_cache);
+    cerr << "Data set loaded\n";
+    cerr << "\tTrain:" << num_train_sents << " sentences" << (stream_training ? " (streamed)" : "") << "\n";
+    cerr << "\tTest:" << test_sents.size() << " sentences\n";
+
+    cerr << "Using " << num_passes << " passes\n";
+
+    // Read features
+    auto feature_set = read_feature_file(template_file, dict);
+    cerr << "Using feature definition:\n";
+    cerr << feature_set->name << "\n";
+    if (feature_set->specialized != nullptr)
+        cerr << "Using the feature extractor generated for this template\n";
+
+    auto strategy = make_strategy(num_arc_constraints_train, num_span_constraints_train, test_sents);
+
+    auto parser = TransitionParser(dict, feature_set, *strategy, num_passes);
+    parser.use_feature_cache = use_feature_cache;
+    parser.feature_cache_file = feature_cache_file;
+    parser.num_threads = num_threads;
+    if (stream_training) {
+        parser.fit(num_train_sents, [&]() {
+            return std::unique_ptr<SentenceStream>(
+                    new PrefetchingSentenceStream(data_file, dict, training_prefetch_size));
+        });
+    } else {
+        parser.fit(train_sents);
+    }
+
+    if (model_file.size() > 0) {
+        parser.save(model_file);
+        cerr << "Model saved to " << model_file << "\n";
+    }
+
+    if (eval_file.size() > 0)
+        evaluate_parser(parser, test_sents, dict, pred_file, num_threads);
+}
+
+
+void load_test_parser(string model_file, string eval_file, string pred_file, size_t num_threads,
+                      bool use_corpus_cache) {
+    auto dict = CorpusDictionary {};
+    std::string template_text;
+    size_t num_trained_moves;
+    auto weights = read_model_file(model_file, dict, template_text, num_trained_moves);
+    cerr << "Model loaded from " << model_file << "\n";
+
+    // The template is parsed after the dictionary is restored, so namespace ids agree with the model
+    auto feature_set = parse_feature_template(template_text, dict);
+    cerr << "Using feature definition:\n";
+    cerr << feature_set->name << "\n";
+    if (feature_set->specialized != nullptr)
+        cerr << "Using the feature extractor generated for this template\n";
+
+    // New labels in the evaluation data would change the move list the weight rows were laid out for
+    dict.frozen = true;
+    auto test_sents = read_corpus(eval_file, dict, num_threads, use_corpus_cache);
+    cerr << "\tTest:" << test_sents.size() << " sentences\n";
 
+    std::vector<Sentence> no_train_sents;
+    auto strategy = make_strategy(no_train_sents, test_sents);
 
+    auto parser = TransitionParser(dict, feature_set, *strategy, std::move(weights), num_trained_moves);
+    evaluate_parser(parser, test_sents, dict, pred_file, num_threads);
 }
 
 namespace po = boost::program_options;
@@ -105,23 +204,94 @@ void print_usage(po::options_description desc) {
 
 }
 
+void serve_parser(string model_file, string socket_path, size_t num_threads) {
+    auto dict = CorpusDictionary {};
+    std::string template_text;
+    size_t num_trained_moves;
+    auto weights = read_model_file(model_file, dict, template_text, num_trained_moves);
+    auto feature_set = parse_feature_template(template_text, dict);
+    // Clients are read concurrently, so the dictionary must not grow. Unknown words are mapped to -1.
+    dict.frozen = true;
+    cerr << "Model loaded from " << model_file << "\n";
+
+    // Constraints may arrive at any time, and the constrained system parses unconstrained sentences the same way
+    ConstrainedArcEager strategy;
+    auto parser = TransitionParser(dict, feature_set, strategy, std::move(weights), num_trained_moves);
+    ParseServer server(parser, dict, num_threads);
+
+    if (socket_path.empty())
+        server.serve_connection(STDIN_FILENO, STDOUT_FILENO);
+    else
+        server.serve_unix_socket(socket_path);
+
+    server.latency_stats.report(cerr);
+}
+
+// hanstholm serve --load-model FILE [--socket PATH] [--threads N]
+int serve_command(int argc, const char* argv[]) {
+    string load_model_file;
+    string socket_path;
+    size_t num_threads = 1;
+
+    po::options_description desc("Allowed options for serve");
+    desc.add_options()
+            ("help", "produce help message")
+            ("load-model", po::value<string>(&load_model_file), "saved model to parse with")
+            ("socket", po::value<string>(&socket_path),
+             "listen on this Unix domain socket instead of reading stdin and writing stdout")
+            ("threads", po::value<size_t>(&num_threads), "number of parsing threads")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+        cout << "Hanstholm parse server\n";
+        cout << desc;
+        return 0;
+    }
+    po::notify(vm);
+
+    if (load_model_file.empty())
+        throw po::required_option("load-model");
+    if (num_threads == 0)
+        throw po::validation_error(po::validation_error::invalid_option_value, "threads");
+
+    serve_parser(load_model_file, socket_path, num_threads);
+    return 0;
+}
+
 int main(int argc, const char* argv[]) {
 
     try {
+        if (argc > 1 && string(argv[1]) == "serve")
+            return serve_command(argc - 1, argv + 1);
+
         string data_file;
         string eval_file;
         string pred_file;
         string template_file;
+        string save_model_file;
+        string load_model_file;
+        string feature_cache_file;
         size_t num_passes = 5;
+        size_t num_threads = 1;
 
         po::options_description desc("Allowed options");
         desc.add_options()
                 ("help", "produce help message")
-                ("data,d", po::value<std::string>(&data_file)->required(), "input datafile")
-                ("eval,e", po::value<std::string>(&eval_file)->required(), "evaluation file")
-                ("template", po::value<std::string>(&template_file)->required(), "template file (e.g. nivre.txt)")
+                ("data,d", po::value<std::string>(&data_file), "input datafile")
+                ("eval,e", po::value<std::string>(&eval_file), "evaluation file")
+                ("template", po::value<std::string>(&template_file), "template file (e.g. nivre.txt)")
                 ("passes", po::value<size_t>(&num_passes), "number of passes over the training set")
                 ("predictions,p", po::value<string>(&pred_file), "write predictions to this file")
+                ("save-model", po::value<string>(&save_model_file), "save the trained model to this file")
+                ("load-model", po::value<string>(&load_model_file), "parse with a saved model instead of training")
+                ("feature-cache", "keep the features of every training transition in memory between passes")
+                ("feature-cache-file", po::value<string>(&feature_cache_file),
+                 "like --feature-cache, but keep the features in this file instead of in memory")
+                ("threads", po::value<size_t>(&num_threads), "number of threads for reading, training and parsing")
+                ("stream-training", "read the training file again in every pass instead of keeping it in memory")
+                ("cache", "keep the parsed input files in binary caches (FILE.cache) and load them in later runs")
                 ("feature_parser", "test feature parser")
                 ;
 
@@ -144,8 +314,27 @@ int main(int argc, const char* argv[]) {
         } else {
             po::notify(vm);
 
-            // Find better way to pass parameters into the program
-            train_test_parser(data_file, eval_file, pred_file, template_file, num_passes);
+            if (num_threads == 0)
+                throw po::validation_error(po::validation_error::invalid_option_value, "threads");
+
+            if (load_model_file.size() > 0) {
+                if (eval_file.empty())
+                    throw po::required_option("eval");
+                load_test_parser(load_model_file, eval_file, pred_file, num_threads, vm.count("cache") > 0);
+            } else {
+                if (data_file.empty())
+                    throw po::required_option("data");
+                if (template_file.empty())
+                    throw po::required_option("template");
+                // Without an evaluation file there is nothing to do but train and save
+                if (eval_file.empty() && save_model_file.empty())
+                    throw po::required_option("eval");
+
+                // Find better way to pass parameters into the program
+                train_test_parser(data_file, eval_file, pred_file, template_file, num_passes, save_model_file,
+                                  vm.count("feature-cache") > 0, feature_cache_file, num_threads,
+                                  vm.count("stream-training") > 0, vm.count("cache") > 0);
+            }
         }
 
 
@@ -153,9 +342,21 @@ int main(int argc, const char* argv[]) {
         cerr << "Error while parsing input file: " << e->what() << "\n";
         return 1;
 
+    } catch (input_parse_error &e) {
+        cerr << "Error while parsing input file: " << e.what() << "\n";
+        return 1;
+
     } catch(exception *e) {
         cerr << "error: " << e->what() << "\n";
         return 1;
+
+    } catch (po::error &e) {
+        cerr << "error: " << e.what() << "\n";
+        return 1;
+
+    } catch (exception &e) {
+        cerr << "error: " << e.what() << "\n";
+        return 1;
     }
 
     return 0;
@@ -0,0 +1,45 @@
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+
+MappedFile::MappedFile(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("File " + filename + " cannot be read");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        close(fd);
+        throw std::runtime_error("File " + filename + " cannot be read");
+    }
+
+    length = static_cast<size_t>(file_stat.st_size);
+    if (length > 0) {
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("File " + filename + " cannot be mapped into memory");
+        }
+        begin = static_cast<const char *>(mapping);
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+    // The mapping stays valid after the file is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (begin != nullptr)
+        munmap(const_cast<char *>(begin), length);
+}
+
+void MappedFile::release(const char *range_begin, const char *range_end) const {
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t first = (static_cast<size_t>(range_begin - begin) + page_size - 1) / page_size * page_size;
+    size_t last = static_cast<size_t>(range_end - begin) / page_size * page_size;
+    if (first < last)
+        madvise(const_cast<char *>(begin) + first, last - first, MADV_DONTNEED);
+}
@@ -0,0 +1,28 @@
+#ifndef HANSTHOLM_MAPPED_FILE_H
+#define HANSTHOLM_MAPPED_FILE_H
+
+#include <string>
+
+/**
+ * A file mapped read-only into memory. The contents stay valid for the lifetime of the object.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return begin; }
+    size_t size() const { return length; }
+
+    // Tells the kernel that the whole pages within [range_begin, range_end) will not be needed soon, so they can
+    // leave the resident set. They stay readable and are paged back in from the file if accessed again.
+    void release(const char *range_begin, const char *range_end) const;
+
+private:
+    const char *begin = nullptr;
+    size_t length = 0;
+};
+
+#endif //HANSTHOLM_MAPPED_FILE_H
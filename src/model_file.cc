@@ -0,0 +1,184 @@
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "model_file.h"
+
+
+static size_t align_offset(size_t offset) {
+    return (offset + model_file_alignment - 1) / model_file_alignment * model_file_alignment;
+}
+
+static void pad_to(std::ofstream &out, size_t offset) {
+    static const char zeros[model_file_alignment] = {};
+    size_t pos = static_cast<size_t>(out.tellp());
+    assert(offset >= pos);
+    out.write(zeros, offset - pos);
+}
+
+template <typename T>
+static void write_string_map(std::ostream &out, const std::unordered_map<std::string, T> &map) {
+    // Ids are assigned consecutively by CorpusDictionary, so storing the keys in id order is enough
+    std::vector<const std::string *> by_id(map.size(), nullptr);
+    for (const auto &kv_pair : map) {
+        assert(kv_pair.second >= 0 && static_cast<size_t>(kv_pair.second) < map.size());
+        by_id[kv_pair.second] = &kv_pair.first;
+    }
+
+    uint64_t count = map.size();
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    for (auto key : by_id) {
+        uint32_t length = static_cast<uint32_t>(key->size());
+        out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        out.write(key->data(), length);
+    }
+}
+
+template <typename T>
+static const char *read_string_map(const char *pos, const char *end, std::unordered_map<std::string, T> &map) {
+    uint64_t count;
+    if (pos + sizeof(count) > end)
+        throw std::runtime_error("Truncated dictionary in model file");
+    memcpy(&count, pos, sizeof(count));
+    pos += sizeof(count);
+
+    map.reserve(count);
+    for (uint64_t id = 0; id < count; id++) {
+        uint32_t length;
+        if (pos + sizeof(length) > end)
+            throw std::runtime_error("Truncated dictionary in model file");
+        memcpy(&length, pos, sizeof(length));
+        pos += sizeof(length);
+        if (pos + length > end)
+            throw std::runtime_error("Truncated dictionary in model file");
+        map.emplace(std::string(pos, length), static_cast<T>(id));
+        pos += length;
+    }
+    return pos;
+}
+
+
+void write_model_file(const std::string &filename, const CorpusDictionary &dict,
+                      const std::string &template_text, const StaticHashTableBlock &weights,
+                      size_t num_labeled_moves) {
+    std::ofstream out(filename, std::ofstream::binary | std::ofstream::trunc);
+    if (!out.good())
+        throw std::runtime_error("Could not open model file " + filename + " for writing");
+
+    ModelFileHeader header {};
+    memcpy(header.magic, model_file_magic, sizeof(header.magic));
+    header.version = model_file_version;
+    header.key_size = sizeof(size_t);
+    header.num_labeled_moves = num_labeled_moves;
+    header.num_buckets = weights.num_buckets();
+    header.num_entries = weights.num_entries();
+    header.value_stride = weights.stride();
+
+    // Header is rewritten once the section offsets are known
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    header.dictionary_offset = align_offset(sizeof(header));
+    pad_to(out, header.dictionary_offset);
+    write_string_map(out, dict.label_to_id);
+    write_string_map(out, dict.namespace_to_id);
+    write_string_map(out, dict.attribute_to_id);
+    header.dictionary_size = static_cast<size_t>(out.tellp()) - header.dictionary_offset;
+
+    header.template_offset = align_offset(static_cast<size_t>(out.tellp()));
+    pad_to(out, header.template_offset);
+    out.write(template_text.data(), template_text.size());
+    header.template_size = template_text.size();
+
+    header.bucket_offsets_offset = align_offset(static_cast<size_t>(out.tellp()));
+    pad_to(out, header.bucket_offsets_offset);
+    out.write(reinterpret_cast<const char *>(weights.bucket_offsets()), (weights.num_buckets() + 1) * sizeof(uint32_t));
+
+    header.keys_offset = align_offset(static_cast<size_t>(out.tellp()));
+    pad_to(out, header.keys_offset);
+    out.write(reinterpret_cast<const char *>(weights.keys()), weights.num_entries() * sizeof(size_t));
+
+    header.values_offset = align_offset(static_cast<size_t>(out.tellp()));
+    pad_to(out, header.values_offset);
+    out.write(reinterpret_cast<const char *>(weights.values()),
+              weights.num_entries() * weights.stride() * sizeof(Cell::value_type));
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!out.good())
+        throw std::runtime_error("Failed writing model file " + filename);
+}
+
+
+StaticHashTableBlock read_model_file(const std::string &filename, CorpusDictionary &dict, std::string &template_text,
+                                     size_t &num_labeled_moves) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("File " + filename + " cannot be read");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1 || static_cast<size_t>(file_stat.st_size) < sizeof(ModelFileHeader)) {
+        close(fd);
+        throw std::runtime_error("File " + filename + " is not a model file");
+    }
+
+    size_t file_size = static_cast<size_t>(file_stat.st_size);
+    void *addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error("Could not memory-map model file " + filename);
+    std::shared_ptr<void> mapping(addr, [file_size](void *p) { munmap(p, file_size); });
+
+    const char *base = static_cast<const char *>(addr);
+    ModelFileHeader header;
+    memcpy(&header, base, sizeof(header));
+
+    if (memcmp(header.magic, model_file_magic, sizeof(header.magic)) != 0)
+        throw std::runtime_error("File " + filename + " is not a model file");
+    if (header.version != model_file_version)
+        throw std::runtime_error("Model file " + filename + " has unsupported version " +
+                                 std::to_string(header.version));
+    if (header.value_stride < header.num_labeled_moves)
+        throw std::runtime_error("Model file " + filename + " is truncated or corrupt");
+    if (header.key_size != sizeof(size_t))
+        throw std::runtime_error("Model file " + filename + " was written on an incompatible platform");
+    if (header.values_offset + header.num_entries * header.value_stride * sizeof(Cell::value_type) > file_size ||
+        header.keys_offset + header.num_entries * sizeof(size_t) > header.values_offset ||
+        header.bucket_offsets_offset + (header.num_buckets + 1) * sizeof(uint32_t) > header.keys_offset ||
+        header.bucket_offsets_offset % model_file_alignment != 0 ||
+        header.keys_offset % model_file_alignment != 0 || header.values_offset % model_file_alignment != 0 ||
+        header.dictionary_offset > file_size || header.dictionary_size > file_size - header.dictionary_offset ||
+        header.template_offset > file_size || header.template_size > file_size - header.template_offset)
+        throw std::runtime_error("Model file " + filename + " is truncated or corrupt");
+
+    // Lookups mask the hash with num_buckets - 1 and scan the keys between consecutive bucket offsets,
+    // so the bucket count must be a power of two and the offsets must stay inside the key array
+    if (header.num_buckets == 0 || (header.num_buckets & (header.num_buckets - 1)) != 0)
+        throw std::runtime_error("Model file " + filename + " is truncated or corrupt");
+    auto *bucket_offsets = reinterpret_cast<const uint32_t *>(base + header.bucket_offsets_offset);
+    for (size_t bucket = 0; bucket < header.num_buckets; bucket++) {
+        if (bucket_offsets[bucket] > bucket_offsets[bucket + 1])
+            throw std::runtime_error("Model file " + filename + " is truncated or corrupt");
+    }
+    if (bucket_offsets[0] != 0 || bucket_offsets[header.num_buckets] != header.num_entries)
+        throw std::runtime_error("Model file " + filename + " is truncated or corrupt");
+
+    assert(dict.label_to_id.empty() && dict.namespace_to_id.empty() && dict.attribute_to_id.empty());
+    const char *dict_pos = base + header.dictionary_offset;
+    const char *dict_end = dict_pos + header.dictionary_size;
+    dict_pos = read_string_map(dict_pos, dict_end, dict.label_to_id);
+    dict_pos = read_string_map(dict_pos, dict_end, dict.namespace_to_id);
+    read_string_map(dict_pos, dict_end, dict.attribute_to_id);
+
+    template_text.assign(base + header.template_offset, header.template_size);
+    num_labeled_moves = header.num_labeled_moves;
+
+    auto *keys = reinterpret_cast<const size_t *>(base + header.keys_offset);
+    auto *values = reinterpret_cast<const Cell::value_type *>(base + header.values_offset);
+    return StaticHashTableBlock(bucket_offsets, keys, values, header.num_buckets, header.num_entries,
+                                header.value_stride, mapping);
+}
@@ -0,0 +1,54 @@
+#ifndef HANSTHOLM_MODEL_FILE_H
+#define HANSTHOLM_MODEL_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include "feature_handling.h"
+#include "features.h"
+
+// On-disk layout of a saved model. All sections start at offsets aligned to `model_file_alignment`,
+// so the frozen weight table can be used in place once the file is memory-mapped.
+//
+//   header | dictionary | template text | bucket offsets (uint32_t[num_buckets + 1])
+//          | keys (size_t[num_entries]) | values (float[num_entries * value_stride])
+//
+// The dictionary section holds the label, namespace and attribute maps, in that order.
+// Each map is a uint64_t count followed by (uint32_t length, bytes) entries ordered by id.
+const char model_file_magic[8] = {'H', 'N', 'S', 'T', 'H', 'O', 'L', 'M'};
+const uint32_t model_file_version = 2;
+const size_t model_file_alignment = 64;
+
+struct ModelFileHeader {
+    char magic[8];
+    uint32_t version;
+    // Guards against loading a model written on a platform with a different word size
+    uint32_t key_size;
+    uint64_t num_labeled_moves;
+    uint64_t num_buckets;
+    uint64_t num_entries;
+    uint64_t value_stride;
+    uint64_t dictionary_offset;
+    uint64_t dictionary_size;
+    uint64_t template_offset;
+    uint64_t template_size;
+    uint64_t bucket_offsets_offset;
+    uint64_t keys_offset;
+    uint64_t values_offset;
+};
+
+/**
+ * Writes the frozen weights, dictionary and template text.
+ */
+void write_model_file(const std::string &filename, const CorpusDictionary &dict,
+                      const std::string &template_text, const StaticHashTableBlock &weights,
+                      size_t num_labeled_moves);
+
+/**
+ * Memory-maps a model written by `write_model_file`. The returned table uses the mapping directly.
+ * `dict` is filled with the stored dictionary and must be empty on entry. `num_labeled_moves` is set to
+ * the number of moves the weight rows were trained for.
+ */
+StaticHashTableBlock read_model_file(const std::string &filename, CorpusDictionary &dict, std::string &template_text,
+                                     size_t &num_labeled_moves);
+
+#endif //HANSTHOLM_MODEL_FILE_H
@@ -6,11 +6,11 @@ void output_parse_result(std::ostream & out, const Sentence & sentence, const Pa
     assert(sentence.tokens.size() == result.heads.size());
     assert(sentence.tokens.size() == result.labels.size());
     for (int i = 0; i < sentence.tokens.size() - 1; i++) {
-        auto token = sentence.tokens[i];
+        const auto &token = sentence.tokens[i];
         auto pred_head = result.heads[i];
         auto pred_label = result.labels[i];
 
-        out << token.id << "\t"
+        out << sentence.token_id(i) << "\t"
                 << token.head << "-" << id_to_label[token.label] << "\t"
                 << pred_head << "-" << id_to_label[pred_label] << "\n";
     }
@@ -32,26 +32,102 @@ bool Sentence::has_edge(token_index_t i, token_index_t j) const {
 }
 
 
-ParseState::ParseState(size_t length) : length(length) {
+ParseState::ParseState(size_t length) {
+    reset(length);
+}
+
+ParseState::ParseState(size_t length, const std::vector<SpanConstraint> &span_constraints) {
+    reset(length, span_constraints);
+}
+
+ParseState::ParseState(const Sentence &sent) {
+    reset(sent);
+}
+
+void ParseState::reset(size_t length_) {
+    length = length_;
     assert(length >= 2);
-    assert(length < 1000);
-	stack.reserve(length);
-	stack.push_back(0);
-	n0 = 1;
-    heads = vector<token_index_t>(length, -1 );
-    labels = vector<label_type_t>(length, -1);
+    stack.clear();
+    stack.reserve(length);
+    stack.push_back(0);
+    n0 = 1;
+    heads.assign(length, -1);
+    labels.assign(length, -1);
+    modifiers.assign(length, TokenModifiers());
+    on_stack.assign(length, 0);
+    on_stack[0] = 1;
+    span_states.clear();
+    gold_deps_on_stack.clear();
+    gold_rightmost_dep.clear();
     update_locations();
 }
 
-ParseState::ParseState(size_t length, size_t num_span_constraints) : ParseState(length) {
-    for (int i = 0; i < num_span_constraints; i++) span_states.emplace_back();
+void ParseState::reset(size_t length, const std::vector<SpanConstraint> &span_constraints) {
+    reset(length);
+    for (auto &sc : span_constraints) {
+        span_states.emplace_back();
+        // The first token starts out on the stack
+        if (sc.is_inside(0))
+            span_states.back().headless_nodes_in_stack = 1;
+    }
+}
+
+void ParseState::reset(const Sentence &sent) {
+    reset(sent.tokens.size(), sent.span_constraints);
+    const auto &tokens = sent.tokens;
+    gold_deps_on_stack.assign(length, 0);
+    gold_rightmost_dep.assign(length, -1);
+    for (token_index_t i = 0; i < static_cast<token_index_t>(length); i++) {
+        if (tokens[i].head >= 0)
+            gold_rightmost_dep[tokens[i].head] = i;
+    }
+
+    // Account for the tokens the stack starts out with
+    for (auto i : stack) {
+        if (tokens[i].head >= 0)
+            gold_deps_on_stack[tokens[i].head]++;
+    }
+}
+
+void ParseState::push(token_index_t index, const std::vector<Token> &tokens) {
+    stack.push_back(index);
+    on_stack[index] = 1;
+    if (tracks_gold() && tokens[index].head >= 0)
+        gold_deps_on_stack[tokens[index].head]++;
+}
+
+void ParseState::pop(const std::vector<Token> &tokens) {
+    auto index = stack.back();
+    stack.pop_back();
+    on_stack[index] = 0;
+    if (tracks_gold() && tokens[index].head >= 0)
+        gold_deps_on_stack[tokens[index].head]--;
 }
 
 
 void ParseState::add_edge(token_index_t head, token_index_t dep, label_type_t label) {
+    // A token gets its head once, so the outermost dependents only ever move outwards
+    assert(heads[dep] == -1);
     heads[dep] = head;
     labels[dep] = label;
     // cout << "Add edge: H=" << head << " D= " << dep << endl;
+
+    auto &head_modifiers = modifiers[head];
+    if (dep < head) {
+        if (head_modifiers.left == -1 || dep < head_modifiers.left) {
+            head_modifiers.left2 = head_modifiers.left;
+            head_modifiers.left = dep;
+        } else if (head_modifiers.left2 == -1 || dep < head_modifiers.left2) {
+            head_modifiers.left2 = dep;
+        }
+    } else {
+        if (head_modifiers.right == -1 || dep > head_modifiers.right) {
+            head_modifiers.right2 = head_modifiers.right;
+            head_modifiers.right = dep;
+        } else if (head_modifiers.right2 == -1 || dep > head_modifiers.right2) {
+            head_modifiers.right2 = dep;
+        }
+    }
 }
 
 bool ParseState::is_terminal() {
@@ -204,23 +280,23 @@ void perform_move(LabeledMove lmove, ParseState &state, const vector<Token> &tok
     switch (lmove.move) {
         case Move::SHIFT:
             assert(state.n0 < tokens.size() - 1);
-            stack.push_back(state.n0);
+            state.push(state.n0, tokens);
             state.n0++;
             break;
         case Move::RIGHT_ARC:
             assert(!stack.empty() && state.n0 < tokens.size() - 1);
             state.add_edge(stack.back(), state.n0, lmove.label);
-            stack.push_back(state.n0);
+            state.push(state.n0, tokens);
             state.n0++;
             break;
         case Move::LEFT_ARC:
             assert(!stack.empty());
             state.add_edge(state.n0, stack.back(), lmove.label);
-            stack.pop_back();
+            state.pop(tokens);
             break;
         case Move::REDUCE:
             assert(!stack.empty());
-            stack.pop_back();
+            state.pop(tokens);
             break;
         default:
             throw std::runtime_error("Invalid move");
@@ -230,23 +306,6 @@ void perform_move(LabeledMove lmove, ParseState &state, const vector<Token> &tok
 }
 
 
-int ParseState::find_left_dep(int middle, int start) const {
-    for (int i = start; i < middle; i++) {
-        if (heads[i] == middle) return i;
-    }
-    return -1;
-}
-
-
-int ParseState::find_right_dep(int middle, int last) const {
-    for (int i = last; i > middle; i--) {
-        if (heads[i] == middle) return i;
-    }
-    return -1;
-}
-
-
-
 void ParseState::update_locations() {
     using namespace state_location;
 
@@ -254,25 +313,19 @@ void ParseState::update_locations() {
 
     if (stack.size() >= 1) {
         locations_[S0] = stack.back();
-        // auto max_head = max_element(heads.begin(), heads.end());
-        // cout << *max_head << endl;
         locations_[S0_head] = heads[locations_[S0]];
-        locations_[S0_left] = find_left_dep(locations_[S0], 0);
-        if (locations_[S0_left] != -1)
-            locations_[S0_left2] = find_left_dep(locations_[S0], locations_[S0_left] + 1);
-
-
-        locations_[S0_right] = find_right_dep(locations_[S0], static_cast<int>(length - 1));
-        if (locations_[S0_right] != -1)
-            locations_[S0_right2] = find_right_dep(locations_[S0], locations_[S0_right] - 1);
+        const auto &s0_modifiers = modifiers[locations_[S0]];
+        locations_[S0_left] = s0_modifiers.left;
+        locations_[S0_left2] = s0_modifiers.left2;
+        locations_[S0_right] = s0_modifiers.right;
+        locations_[S0_right2] = s0_modifiers.right2;
     }
 
     locations_[N0] = n0;
-    locations_[N0_left] = find_left_dep(locations_[N0], 0);
-    if (locations_[N0_left] != -1)
-        locations_[N0_left2] = find_left_dep(locations_[N0], locations_[N0_left] + 1);
-
-    locations_[N0_right] = find_right_dep(locations_[N0], static_cast<int>(length - 1));
+    const auto &n0_modifiers = modifiers[n0];
+    locations_[N0_left] = n0_modifiers.left;
+    locations_[N0_left2] = n0_modifiers.left2;
+    locations_[N0_right] = n0_modifiers.right;
 
     if (locations_[N0] < (length - 1))
         locations_[N1] = locations_[N0] + 1;
@@ -286,154 +339,243 @@ bool ParseState::has_head_in_buffer(token_index_t index, Sentence const & sent)
 }
 
 bool ParseState::has_head_in_stack(token_index_t index, Sentence const & sent) const {
-    for (auto i : stack) {
-        if (sent.tokens[index].head == i)
-            return true;
-    }
-    return false;
+    assert(tracks_gold());
+    auto head = sent.tokens[index].head;
+    return head >= 0 && on_stack[head];
 }
 
 bool ParseState::has_dep_in_buffer(token_index_t index, Sentence const & sent) const {
-    for (int i = n0; i < length; i++) {
-        if (sent.tokens[i].head == index)
-            return true;
-    }
-    return false;
+    assert(tracks_gold());
+    // The buffer holds the tokens from n0 to the end
+    return gold_rightmost_dep[index] >= n0;
 }
 
 bool ParseState::has_dep_in_stack(token_index_t index, Sentence const & sent) const {
-    for (auto i : stack) {
-        if (sent.tokens[i].head == index)
-            return true;
-    }
-    return false;
+    assert(tracks_gold());
+    return gold_deps_on_stack[index] > 0;
 }
 
-label_type_t CorpusDictionary::map_label(string label) {
+label_type_t CorpusDictionary::map_label(const string &label) {
     return map_any(label_to_id, label);
 }
 
-attribute_t CorpusDictionary::map_attribute(string attribute) {
+attribute_t CorpusDictionary::map_attribute(const string &attribute) {
     return map_any(attribute_to_id, attribute);
 }
 
 
-namespace_t CorpusDictionary::map_namespace(string ns) {
+namespace_t CorpusDictionary::map_namespace(const string &ns) {
     return map_any(namespace_to_id, ns);
 }
 
 template <typename T>
-T CorpusDictionary::map_any(unordered_map<string, T> & map, string key) {
-    if (frozen) {
-        auto got = map.find(key);
-        if (got != map.end())
-            return got->second;
-        else
-            return -1;
-    } else {
-        auto pair = map.emplace(key, map.size());
-        return pair.first->second;
+T CorpusDictionary::map_any(unordered_map<string, T> & map, const string &key) {
+    // Look up first, so that the key is only copied for new entries
+    auto got = map.find(key);
+    if (got != map.end())
+        return got->second;
+    else if (frozen)
+        return -1;
+    else
+        return map.emplace(key, map.size()).first->second;
+}
+
+namespace {
+
+// Lists the keys of a dictionary map in the order of their ids
+template <typename T>
+vector<const string *> keys_by_id(const unordered_map<string, T> &map) {
+    vector<const string *> keys(map.size());
+    for (auto &kv_pair : map)
+        keys[kv_pair.second] = &kv_pair.first;
+    return keys;
+}
+
+}
+
+DictionaryIdMap CorpusDictionary::merge(const CorpusDictionary &other) {
+    DictionaryIdMap id_map;
+    for (auto key : keys_by_id(other.label_to_id))
+        id_map.labels.push_back(map_label(*key));
+    for (auto key : keys_by_id(other.attribute_to_id))
+        id_map.attributes.push_back(map_attribute(*key));
+    for (auto key : keys_by_id(other.namespace_to_id))
+        id_map.namespaces.push_back(map_namespace(*key));
+    return id_map;
+}
+
+void DictionaryIdMap::apply(Sentence &sentence) const {
+    for (auto &token : sentence.tokens)
+        token.label = labels[token.label];
+    for (auto &ns : sentence.namespaces)
+        ns.index = namespaces[ns.index];
+    for (auto &attribute : sentence.attributes)
+        attribute.index = attributes[attribute.index];
+    sentence.index_namespaces();
+}
+
+constexpr uint32_t Sentence::no_namespace;
+
+void Sentence::index_namespaces() {
+    // Namespaces unknown to a frozen dictionary have index -1. No template refers to them, so they are left out.
+    namespace_table_width = 0;
+    for (const auto &ns_front : namespaces) {
+        if (ns_front.index >= 0)
+            namespace_table_width = std::max(namespace_table_width, static_cast<uint32_t>(ns_front.index) + 1);
+    }
+
+    namespace_table.assign(tokens.size() * namespace_table_width, no_namespace);
+    token_specific_namespaces.clear();
+    for (const auto &token : tokens) {
+        for (auto i = token.namespaces_begin; i < token.namespaces_end; i++) {
+            const auto &ns_front = namespaces[i];
+            if (ns_front.index < 0)
+                continue;
+            size_t cell = static_cast<size_t>(token.index) * namespace_table_width + ns_front.index;
+            // A namespace declared twice on a token is found at its first declaration
+            if (ns_front.token_specific_ns == -1) {
+                if (namespace_table[cell] == no_namespace)
+                    namespace_table[cell] = i;
+            } else {
+                token_specific_namespaces.emplace(
+                        static_cast<uint64_t>(static_cast<uint32_t>(ns_front.token_specific_ns)) << 32 | cell, i);
+            }
+        }
     }
 }
 
-const attribute_vector &Token::find_namespace(namespace_t ns, namespace_t token_specific_ns) const {
-    auto ns_found = std::find_if(namespaces_ng.cbegin(), namespaces_ng.cend(),
-                                 [ns,token_specific_ns](const NamespaceFront & ns_front) {
-                                     return ns_front.index == ns && ns_front.token_specific_ns == token_specific_ns;} );
 
+void TokenIndex::build(size_t num_tokens, const std::vector<std::pair<token_index_t, uint32_t>> &entries) {
+    // Count the items of each token, then fill them in
+    begin.assign(num_tokens + 1, 0);
+    for (auto &entry : entries)
+        begin[entry.first + 1]++;
+    for (size_t i = 1; i < begin.size(); i++)
+        begin[i] += begin[i - 1];
 
-    if (ns_found != namespaces_ng.cend()) {
-        return ns_found->attributes;
-    } else {
-        return _empty_attribute_vector;
+    items.resize(entries.size());
+    std::vector<uint32_t> next(begin.begin(), begin.end() - 1);
+    for (auto &entry : entries)
+        items[next[entry.first]++] = entry.second;
+}
+
+void Sentence::index_constraints() {
+    auto num_tokens = static_cast<token_index_t>(tokens.size());
+    std::vector<std::pair<token_index_t, uint32_t>> entries;
+
+    // An arc constraint is listed under its head and its dependent, but only once if they are the same token.
+    // Ends outside the sentence, such as the root, are skipped.
+    for (uint32_t c = 0; c < arc_constraints.size(); c++) {
+        const auto &constraint = arc_constraints[c];
+        if (constraint.head >= 0 && constraint.head < num_tokens)
+            entries.emplace_back(constraint.head, c);
+        if (constraint.dep >= 0 && constraint.dep < num_tokens && constraint.dep != constraint.head)
+            entries.emplace_back(constraint.dep, c);
     }
+    arc_constraints_by_token.build(tokens.size(), entries);
+
+    entries.clear();
+    for (uint32_t c = 0; c < span_constraints.size(); c++) {
+        const auto &constraint = span_constraints[c];
+        for (auto i = std::max(constraint.span_start, 0); i <= std::min(constraint.span_end, num_tokens - 1); i++)
+            entries.emplace_back(i, c);
+    }
+    span_constraints_by_token.build(tokens.size(), entries);
 }
 
 
-void enforce_arc_constraints(const ParseState &state, const Sentence &sent, LabeledMoveSet &allowed_moves) {
-    // Check arc constraints
-    const auto s0 = state.stack.back();
+// Disallows the moves that would make `ac` unreachable. Only constraints that involve S0 or N0 can be affected.
+static void enforce_arc_constraint(const ArcConstraint &ac, const ParseState &state, LabeledMoveSet &allowed_moves) {
+    // Without a stack, S0 is -1. The rules that mention S0 then only restrict moves that need a stack anyway.
+    const auto s0 = state.stack.empty() ? -1 : state.stack.back();
     const auto n0 = state.n0;
+    auto on_stack = [&state](token_index_t i) {
+        return i >= 0 && i < static_cast<token_index_t>(state.length) && state.on_stack[i];
+    };
+
+    // LEFT-ARC (S|i, j|B): adds (j, i), pops i from S
+    // Makes any edge (x, i) and (i, x) unreachable, where x is in B
+    if ((ac.head == s0 && ac.dep >= n0) || (ac.dep == s0 && ac.head > n0))
+        allowed_moves.set(Move::LEFT_ARC, false);
+
+    // RIGHT-ARC (S|i, j|B): adds (i, j), pushes j on S
+    // Makes any edge (j, x) and (x, j) unreachable, where x is in S
+    if ((ac.head == n0 || ac.dep == n0) && !(ac.head == s0 && ac.dep == n0)) {
+        if (on_stack(ac.head) || on_stack(ac.dep))
+            allowed_moves.set(Move::RIGHT_ARC, false);
+    }
 
-    for (const auto & ac : sent.arc_constraints) {
-        // LEFT-ARC (S|i, j|B): adds (j, i), pops i from S
-        // Makes any edge (x, i) and (i, x) unreachable, where x is in B
-        if ((ac.head == s0 && ac.dep >= n0) || (ac.dep == s0 && ac.head > n0))
-            allowed_moves.set(Move::LEFT_ARC, false);
-
-        // RIGHT-ARC (S|i, j|B): adds (i, j), pushes j on S
-        // Makes any edge (j, x) and (x, j) unreachable, where x is in S
-        if ((ac.head == n0 || ac.dep == n0) && !(ac.head == s0 && ac.dep == n0)) {
-            for (auto si = state.stack.cbegin(); si != state.stack.cend(); si++) {
-                if (ac.head == *si || ac.dep == *si) {
-                    allowed_moves.set(Move::RIGHT_ARC, false);
-                    continue;
-                }
-            }
-        }
+    // REDUCE (S|i, j|B): pops i from S
+    // Makes any edge (x, i) and (i, x) unreachable, where x is in B
+    if ((ac.head == s0 && ac.dep >= n0) || (ac.dep == s0 && ac.head >= n0))
+        allowed_moves.set(Move::REDUCE, false);
 
-        // REDUCE (S|i, j|B): pops i from S
-        // Makes any edge (x, i) and (i, x) unreachable, where x is in B
-        if ((ac.head == s0 && ac.dep >= n0) || (ac.dep == s0 && ac.head >= n0))
-            allowed_moves.set(Move::REDUCE, false);
-
-        // SHIFT (S, j|B): pushes j onto S
-        // Makes any edge (j, x) and (x, j) unreachable, where x is in S
-        if (ac.head == n0 || ac.dep == n0) {
-            for (auto si = state.stack.cbegin(); si != state.stack.cend(); si++) {
-                if (ac.head == *si || ac.dep == *si) {
-                    allowed_moves.set(Move::SHIFT, false);
-                    continue;
-                }
-            }
-        }
+    // SHIFT (S, j|B): pushes j onto S
+    // Makes any edge (j, x) and (x, j) unreachable, where x is in S
+    if (ac.head == n0 || ac.dep == n0) {
+        if (on_stack(ac.head) || on_stack(ac.dep))
+            allowed_moves.set(Move::SHIFT, false);
+    }
+}
+
+void enforce_arc_constraints(const ParseState &state, const Sentence &sent, LabeledMoveSet &allowed_moves) {
+    if (sent.arc_constraints.empty())
+        return;
+    assert(sent.arc_constraints_by_token.begin.size() == sent.tokens.size() + 1);
+
+    // Check the arc constraints of S0, if there is one, and N0
+    for (auto token : {state.stack.empty() ? -1 : state.stack.back(), state.n0}) {
+        if (token == -1)
+            continue;
+        auto range = sent.arc_constraints_by_token.of(token);
+        for (auto c = range.first; c != range.second; c++)
+            enforce_arc_constraint(sent.arc_constraints[*c], state, allowed_moves);
     }
 }
 
 void enforce_span_constraints(const ParseState &state, const Sentence &sent, LabeledMoveSet &allowed_moves) {
     const auto n0 = state.n0;
 
+    if (sent.span_constraints.empty() || state.stack.size() == 0) {
+        // Without a stack, SHIFT is the only possible operation
+        return;
+    }
+    assert(sent.span_constraints_by_token.begin.size() == sent.tokens.size() + 1);
+    const auto s0 = state.stack.back();
+
     bool no_left_arc = !allowed_moves.test(Move::LEFT_ARC);
     bool no_right_arc = !allowed_moves.test(Move::RIGHT_ARC);
     bool no_reduce = !allowed_moves.test(Move::REDUCE);
     bool no_shift = !allowed_moves.test(Move::SHIFT);
 
-    for (size_t i = 0; i < sent.span_constraints.size(); i++) {
-        const auto &sc = sent.span_constraints[i];
-        const auto &st = state.span_states[i];
-
-        if (state.stack.size() == 0) {
-            // SHIFT is the only possible operation
-            continue;
-        }
-
+    // Whatever action we take, it only concerns the spans that contain S0 or N0.
+    // Those that contain both are checked with S0.
+    for (auto token : {s0, n0}) {
+        auto span_range = sent.span_constraints_by_token.of(token);
+        for (auto c = span_range.first; c != span_range.second; c++) {
+            const auto &sc = sent.span_constraints[*c];
+            const auto &st = state.span_states[*c];
+            if (token == n0 && sc.is_inside(s0))
+                continue;
 
-        const auto s0 = state.stack.back();
-        const bool s0_inside = sc.is_inside(s0);
-        const bool n0_inside = sc.is_inside(n0);
+            const bool s0_inside = sc.is_inside(s0);
+            const bool n0_inside = sc.is_inside(n0);
 
+            // Number of span nodes in stack with no assigned head.
+            // As we exit the span (by pushing the last span node on the stack),
+            // we can have at most one unfinished node, since it be force to obtain a head outside the span.
+            const auto headless_span_nodes_in_stack = st.headless_nodes_in_stack;
 
-        // Whatever action we take, it doesn't concern this span
-        if (!(s0_inside || n0_inside))
-            continue;
 
-        // Number of span nodes in stack with no assigned head.
-        // As we exit the span (by pushing the last span node on the stack),
-        // we can have at most one unfinished node, since it be force to obtain a head outside the span.
-        auto headless_span_nodes_in_stack = std::count_if(state.stack.cbegin(), state.stack.cend(),
-                                                          [&sc,&state](token_index_t token_index) {
-                                                         return sc.is_inside(token_index) && state.heads[token_index] == -1; });
+            const bool n0_is_root = st.designated_root == n0;
+            const bool s0_is_root = st.designated_root == s0;
+            const bool has_root = st.designated_root  != -1;;
 
-
-        const bool n0_is_root = st.designated_root == n0;
-        const bool s0_is_root = st.designated_root == s0;
-        const bool has_root = st.designated_root  != -1;;
-
-        // N0 is a possible root if it is the actual root or there is no other root
-        // and N0 is not a dependent of a node within the span.
-        const bool n0_possible_root = n0_is_root || (!has_root && n0_inside && !sc.is_inside(state.heads[n0]));
-        // Same story with S0
-        const bool s0_possible_root = s0_is_root || (!has_root && s0_inside && !sc.is_inside(state.heads[s0]));
+            // N0 is a possible root if it is the actual root or there is no other root
+            // and N0 is not a dependent of a node within the span.
+            const bool n0_possible_root = n0_is_root || (!has_root && n0_inside && !sc.is_inside(state.heads[n0]));
+            // Same story with S0
+            const bool s0_possible_root = s0_is_root || (!has_root && s0_inside && !sc.is_inside(state.heads[s0]));
 
 //        std::cerr << "head(n0): " << state.heads[n0] << "\n";
 //        std::cerr << "head(s0): " << state.heads[s0] << "\n";
@@ -448,70 +590,71 @@ void enforce_span_constraints(const ParseState &state, const Sentence &sent, Lab
 //        std::cerr << "has_root: " << has_root << "\n";
 //        std::cerr << "permit_root_deps: " << sc.permit_root_deps << "\n";
 
-        //
-        // LEFT-ARC (S|i, j|B): adds (j, i), pops i from S
-        //
+            //
+            // LEFT-ARC (S|i, j|B): adds (j, i), pops i from S
+            //
 
-        // S0 is span root, but we are trying to make it a dependent of an N0 inside the span
-        no_left_arc = no_left_arc || (s0_is_root && n0_inside);
+            // S0 is span root, but we are trying to make it a dependent of an N0 inside the span
+            no_left_arc = no_left_arc || (s0_is_root && n0_inside);
 
-        // S0 is not the span root (and cannot become the span root),
-        // yet we are trying to make it the dependent of something outside of the span
-        no_left_arc = no_left_arc || (has_root && !s0_is_root && !n0_inside);
+            // S0 is not the span root (and cannot become the span root),
+            // yet we are trying to make it the dependent of something outside of the span
+            no_left_arc = no_left_arc || (has_root && !s0_is_root && !n0_inside);
 
-        // We're trying to make N0 the head of something outside the span, but it is not the root
-        no_left_arc = no_left_arc || (sc.permit_root_deps && has_root && !n0_is_root && n0_inside && !s0_inside);
+            // We're trying to make N0 the head of something outside the span, but it is not the root
+            no_left_arc = no_left_arc || (sc.permit_root_deps && has_root && !n0_is_root && n0_inside && !s0_inside);
 
-        // We're trying to make N0 the head of a node outside the span, but we don't allow outside dependencies
-        no_left_arc = no_left_arc || (!sc.permit_root_deps && n0_inside && !s0_inside);
+            // We're trying to make N0 the head of a node outside the span, but we don't allow outside dependencies
+            no_left_arc = no_left_arc || (!sc.permit_root_deps && n0_inside && !s0_inside);
 
-        //
-        // RIGHT-ARC (S|i, j|B): adds (i, j), pushes j on S
-        //
+            //
+            // RIGHT-ARC (S|i, j|B): adds (i, j), pushes j on S
+            //
 
 
-        // We're pushing the last node of the span onto the stack.
-        // This node is the final call for span nodes in the stack without a head
-        // to get a head within the span.
-        // We allow one "open" node, which could be the root of the span.
-        no_right_arc = no_right_arc || (sc.span_end == n0 && headless_span_nodes_in_stack > 1);
+            // We're pushing the last node of the span onto the stack.
+            // This node is the final call for span nodes in the stack without a head
+            // to get a head within the span.
+            // We allow one "open" node, which could be the root of the span.
+            no_right_arc = no_right_arc || (sc.span_end == n0 && headless_span_nodes_in_stack > 1);
 
-        // We're trying to make S0 head of N0, but N0 is span root.
-        no_right_arc = no_right_arc || (n0_is_root && s0_inside);
+            // We're trying to make S0 head of N0, but N0 is span root.
+            no_right_arc = no_right_arc || (n0_is_root && s0_inside);
 
-        // Although N0 cannot be the root, we're trying to make it a dependent of something outside the span
-        no_right_arc = no_right_arc || (!n0_possible_root && !s0_inside);
+            // Although N0 cannot be the root, we're trying to make it a dependent of something outside the span
+            no_right_arc = no_right_arc || (!n0_possible_root && !s0_inside);
 
-        // We're giving S0 a dependent outside the span, but that's not allowed
-        no_right_arc = no_right_arc || (!sc.permit_root_deps && s0_inside && !n0_inside);
+            // We're giving S0 a dependent outside the span, but that's not allowed
+            no_right_arc = no_right_arc || (!sc.permit_root_deps && s0_inside && !n0_inside);
 
-        // We're giving S0 a dependent outside the span, but S0 cannot be the root
-        no_right_arc = no_right_arc || (sc.permit_root_deps && !s0_possible_root && !n0_inside);
+            // We're giving S0 a dependent outside the span, but S0 cannot be the root
+            no_right_arc = no_right_arc || (sc.permit_root_deps && !s0_possible_root && !n0_inside);
 
-        //
-        // REDUCE (S|i, j|B): pops i from S
-        //
+            //
+            // REDUCE (S|i, j|B): pops i from S
+            //
 
-        // We're about to lose S0, but it's the root of the span, and there's
-        // no way N0 can be a descendant of S0 already
+            // We're about to lose S0, but it's the root of the span, and there's
+            // no way N0 can be a descendant of S0 already
 
-        no_reduce = no_reduce || (s0_is_root && n0_inside);
+            no_reduce = no_reduce || (s0_is_root && n0_inside);
 
-        //
-        // SHIFT (S, j|B): pushes j onto S
-        //
+            //
+            // SHIFT (S, j|B): pushes j onto S
+            //
 
-        // We're pushing the last token in the span to the stack, making
-        // it unavailable for further attachments inside the span.
-        // The span must therefore have no unfinished nodes.
+            // We're pushing the last token in the span to the stack, making
+            // it unavailable for further attachments inside the span.
+            // The span must therefore have no unfinished nodes.
 
-        // no_shift = no_shift || (sc.span_end == n0 && st.num_connected_components > 0);
-        no_shift = no_shift || (sc.span_end == n0 && headless_span_nodes_in_stack != 0);
+            // no_shift = no_shift || (sc.span_end == n0 && st.num_connected_components > 0);
+            no_shift = no_shift || (sc.span_end == n0 && headless_span_nodes_in_stack != 0);
 
 //        cerr << "no_left_arc = " << no_left_arc << "\n";
 //        cerr << "no_right_arc = " << no_right_arc << "\n";
 //        cerr << "no_shift = " << no_shift << "\n";
 //        cerr << "no_reduce = " << no_reduce << "\n";
+        }
     }
 
     if (no_left_arc)    allowed_moves.set(Move::LEFT_ARC, false);
@@ -560,6 +703,12 @@ float ParseScore::uas() {
         return 0;
 }
 
+void ParseScore::add(const ParseScore &other) {
+    num_correct_unlabeled += other.num_correct_unlabeled;
+    num_correct_labeled += other.num_correct_labeled;
+    num_total += other.num_total;
+}
+
 
 void print_vector(std::string name, std::vector<int> numbers) {
     std::cout << "'" << name << "': [";
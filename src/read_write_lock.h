@@ -0,0 +1,55 @@
+#ifndef HANSTHOLM_READ_WRITE_LOCK_H
+#define HANSTHOLM_READ_WRITE_LOCK_H
+
+#include <pthread.h>
+#include <stdexcept>
+
+/**
+ * Thin wrapper around a POSIX read-write lock. Many readers may hold the lock at once,
+ * a writer holds it alone. Writers are preferred where the platform allows it,
+ * so that a steady stream of readers cannot starve them.
+ *
+ * `lock` and `unlock` take the exclusive lock, so the class works with `std::unique_lock`.
+ */
+class ReadWriteLock {
+public:
+    ReadWriteLock() {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        int error = pthread_rwlock_init(&rwlock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+        if (error != 0)
+            throw std::runtime_error("Could not initialize read-write lock");
+    }
+
+    ~ReadWriteLock() {
+        pthread_rwlock_destroy(&rwlock);
+    }
+
+    ReadWriteLock(const ReadWriteLock &) = delete;
+    ReadWriteLock &operator=(const ReadWriteLock &) = delete;
+
+    void lock() { pthread_rwlock_wrlock(&rwlock); }
+    void unlock() { pthread_rwlock_unlock(&rwlock); }
+    void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+    void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+
+private:
+    pthread_rwlock_t rwlock;
+};
+
+// Holds a shared lock for the lifetime of the object
+class SharedLockGuard {
+public:
+    SharedLockGuard(ReadWriteLock &lock) : lock(lock) { lock.lock_shared(); }
+    ~SharedLockGuard() { lock.unlock_shared(); }
+    SharedLockGuard(const SharedLockGuard &) = delete;
+    SharedLockGuard &operator=(const SharedLockGuard &) = delete;
+private:
+    ReadWriteLock &lock;
+};
+
+#endif //HANSTHOLM_READ_WRITE_LOCK_H
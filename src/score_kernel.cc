@@ -0,0 +1,82 @@
+#include <assert.h>
+#include "score_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HANSTHOLM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+static void accumulate_row_scalar(float *scores, const float *row, size_t num_elems, float value) {
+    if (value == 1) {
+        for (size_t i = 0; i < num_elems; i++)
+            scores[i] += row[i];
+    } else {
+        for (size_t i = 0; i < num_elems; i++)
+            scores[i] += value * row[i];
+    }
+}
+
+#ifdef HANSTHOLM_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void accumulate_row_sse(float *scores, const float *row, size_t num_elems, float value) {
+    assert(num_elems % 4 == 0);
+    if (value == 1) {
+        for (size_t i = 0; i < num_elems; i += 4) {
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(scores + i), _mm_loadu_ps(row + i));
+            _mm_storeu_ps(scores + i, sum);
+        }
+    } else {
+        const __m128 scale = _mm_set1_ps(value);
+        for (size_t i = 0; i < num_elems; i += 4) {
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(scores + i), _mm_mul_ps(scale, _mm_loadu_ps(row + i)));
+            _mm_storeu_ps(scores + i, sum);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void accumulate_row_avx2(float *scores, const float *row, size_t num_elems, float value) {
+    assert(num_elems % score_vector_width == 0);
+    if (value == 1) {
+        for (size_t i = 0; i < num_elems; i += 8) {
+            __m256 sum = _mm256_add_ps(_mm256_loadu_ps(scores + i), _mm256_loadu_ps(row + i));
+            _mm256_storeu_ps(scores + i, sum);
+        }
+    } else {
+        // No FMA: the fused rounding would make results depend on the CPU
+        const __m256 scale = _mm256_set1_ps(value);
+        for (size_t i = 0; i < num_elems; i += 8) {
+            __m256 sum = _mm256_add_ps(_mm256_loadu_ps(scores + i), _mm256_mul_ps(scale, _mm256_loadu_ps(row + i)));
+            _mm256_storeu_ps(scores + i, sum);
+        }
+    }
+}
+
+#endif
+
+
+accumulate_row_fn accumulate_row_kernel(const std::string &name) {
+    if (name == "scalar")
+        return accumulate_row_scalar;
+#ifdef HANSTHOLM_X86_KERNELS
+    __builtin_cpu_init();
+    if (name == "sse" && __builtin_cpu_supports("sse2"))
+        return accumulate_row_sse;
+    if (name == "avx2" && __builtin_cpu_supports("avx2"))
+        return accumulate_row_avx2;
+#endif
+    return nullptr;
+}
+
+static accumulate_row_fn select_accumulate_row() {
+    for (auto name : {"avx2", "sse"}) {
+        auto kernel = accumulate_row_kernel(name);
+        if (kernel != nullptr)
+            return kernel;
+    }
+    return accumulate_row_scalar;
+}
+
+const accumulate_row_fn accumulate_row = select_accumulate_row();
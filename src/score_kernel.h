@@ -0,0 +1,26 @@
+#ifndef HANSTHOLM_SCORE_KERNEL_H
+#define HANSTHOLM_SCORE_KERNEL_H
+
+#include <stddef.h>
+#include <string>
+
+// Weight rows and score vectors are padded to a multiple of this many floats (one AVX register),
+// so the kernels never need a scalar tail loop.
+const size_t score_vector_width = 8;
+
+inline size_t padded_row_size(size_t num_elems) {
+    return (num_elems + score_vector_width - 1) / score_vector_width * score_vector_width;
+}
+
+// scores[i] += value * row[i] for i < num_elems. `num_elems` must be a multiple of `score_vector_width`.
+// Every variant computes the product and the sum as two separately rounded operations,
+// so results are identical regardless of which one is dispatched.
+using accumulate_row_fn = void (*)(float *scores, const float *row, size_t num_elems, float value);
+
+// Picks the widest kernel supported by the CPU at startup.
+extern const accumulate_row_fn accumulate_row;
+
+// Kernel by name ("scalar", "sse", "avx2"), or nullptr if it is not supported by this CPU or build.
+accumulate_row_fn accumulate_row_kernel(const std::string &name);
+
+#endif //HANSTHOLM_SCORE_KERNEL_H
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "input.h"
+#include "output.h"
+
+namespace {
+
+// Input stream buffer over a file descriptor, so a socket can be read with `VwSentenceReader`
+class FdInputBuffer : public std::streambuf {
+public:
+    FdInputBuffer(int fd) : fd(fd), buffer(1 << 16) { }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        ssize_t num_read;
+        do {
+            num_read = read(fd, buffer.data(), buffer.size());
+        } while (num_read < 0 && errno == EINTR);
+        if (num_read <= 0)
+            return traits_type::eof();
+
+        setg(buffer.data(), buffer.data(), buffer.data() + num_read);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+};
+
+bool write_all(int fd, const std::string &data) {
+    size_t num_written = 0;
+    while (num_written < data.size()) {
+        ssize_t result = write(fd, data.data() + num_written, data.size() - num_written);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        num_written += result;
+    }
+    return true;
+}
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) {
+    stop_requested = 1;
+}
+
+}
+
+
+void LatencyStats::record(double microseconds) {
+    int bucket = 0;
+    if (microseconds >= 1)
+        bucket = std::min(num_buckets - 1, 1 + static_cast<int>(std::log2(microseconds) * buckets_per_doubling));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    bucket_counts[bucket]++;
+    num_samples++;
+    sum += microseconds;
+    max = std::max(max, microseconds);
+}
+
+size_t LatencyStats::count() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_samples;
+}
+
+double LatencyStats::percentile(double fraction) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return percentile_locked(fraction);
+}
+
+double LatencyStats::upper_bound(int bucket) const {
+    // Bucket b > 0 holds latencies from 2^((b - 1) / 8) up to 2^(b / 8) us
+    return std::exp2(static_cast<double>(bucket) / buckets_per_doubling);
+}
+
+double LatencyStats::percentile_locked(double fraction) const {
+    if (num_samples == 0)
+        return 0;
+    // The rank of the sample that would be picked from the sorted latencies
+    uint64_t rank = std::min(num_samples - 1, static_cast<size_t>(fraction * num_samples));
+    uint64_t num_below = 0;
+    for (int bucket = 0; bucket < num_buckets; bucket++) {
+        num_below += bucket_counts[bucket];
+        if (num_below > rank)
+            return std::min(max, upper_bound(bucket));
+    }
+    return max;
+}
+
+void LatencyStats::report(std::ostream &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "Served " << num_samples << " sentences\n";
+    if (num_samples == 0)
+        return;
+
+    out << "Latency (us): mean " << sum / num_samples
+        << ", p50 " << percentile_locked(0.5)
+        << ", p90 " << percentile_locked(0.9)
+        << ", p99 " << percentile_locked(0.99)
+        << ", max " << max << "\n";
+}
+
+
+ParseServer::ParseServer(TransitionParser &parser, CorpusDictionary &dict, size_t num_workers,
+                         size_t max_pending_per_connection)
+        : parser(parser), dict(dict), id_to_label(invert_map(dict.label_to_id)),
+          max_pending_per_connection(max_pending_per_connection) {
+    // A client that disconnects before reading its answers must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < num_workers; i++)
+        workers.emplace_back(&ParseServer::worker_loop, this);
+}
+
+ParseServer::~ParseServer() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_not_empty.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ParseServer::worker_loop() {
+    auto scratch = parser.make_scratch();
+    // `output_parse_result` inserts unknown labels into the map, so each worker has its own copy
+    auto labels = id_to_label;
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_not_empty.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        std::ostringstream response;
+        try {
+            if (!job.error.empty())
+                throw std::runtime_error(job.error);
+            auto result = parser.parse(job.sentence, scratch);
+            output_parse_result(response, job.sentence, result, labels);
+        } catch (std::exception &e) {
+            response.str("");
+            response << "# error: " << e.what() << "\n";
+        }
+        response << "\n";
+        answer(job, response.str());
+    }
+}
+
+void ParseServer::answer(Job &job, std::string &&response) {
+    // The writing is left to the connection's writer, so a client that does not read never blocks a worker
+    auto &connection = *job.connection;
+    std::lock_guard<std::mutex> lock(connection.mutex);
+    connection.waiting_answers.emplace(job.sequence_no, std::make_pair(std::move(response), job.received));
+    connection.answer_ready.notify_one();
+}
+
+void ParseServer::write_answers(Connection &connection) {
+    bool write_failed = false;
+    std::unique_lock<std::mutex> lock(connection.mutex);
+    while (true) {
+        auto next_is_ready = [&connection]() {
+            return !connection.waiting_answers.empty() &&
+                   connection.waiting_answers.begin()->first == connection.num_answered;
+        };
+        connection.answer_ready.wait(lock, [&]() {
+            return next_is_ready() || (connection.input_ended && connection.num_answered == connection.num_received);
+        });
+        if (!next_is_ready())
+            return;
+
+        auto next = connection.waiting_answers.begin();
+        auto answer = std::move(next->second);
+        connection.waiting_answers.erase(next);
+
+        lock.unlock();
+        // After a failed write the client is gone, and its remaining answers are dropped
+        if (!write_failed)
+            write_failed = !write_all(connection.out_fd, answer.first);
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - answer.second);
+        latency_stats.record(latency.count());
+        lock.lock();
+
+        connection.num_answered++;
+        connection.answer_written.notify_all();
+    }
+}
+
+void ParseServer::serve_connection(int in_fd, int out_fd) {
+    Connection connection;
+    connection.out_fd = out_fd;
+    FdInputBuffer input_buffer(in_fd);
+    std::istream in(&input_buffer);
+    VwSentenceReader reader("<client>", dict);
+    std::thread writer(&ParseServer::write_answers, this, std::ref(connection));
+
+    // Reading errors other than malformed sentences end the connection
+    std::exception_ptr read_error;
+    try {
+        while (true) {
+            Job job;
+            job.connection = &connection;
+            try {
+                if (!reader.read_sentence(in, job.sentence))
+                    break;
+            } catch (input_parse_error &e) {
+                job.error = e.what();
+            }
+            job.received = clock::now();
+
+            {
+                // Do not read further ahead of the answers than the limit
+                std::unique_lock<std::mutex> lock(connection.mutex);
+                connection.answer_written.wait(lock, [&]() {
+                    return connection.num_received - connection.num_answered < max_pending_per_connection;
+                });
+                job.sequence_no = connection.num_received++;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                queue.push_back(std::move(job));
+            }
+            queue_not_empty.notify_one();
+        }
+    } catch (...) {
+        read_error = std::current_exception();
+    }
+
+    // The workers refer to the connection until its writer has taken the last answer
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        connection.input_ended = true;
+        connection.answer_ready.notify_one();
+    }
+    writer.join();
+    if (read_error)
+        std::rethrow_exception(read_error);
+}
+
+void ParseServer::serve_unix_socket(const std::string &path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path " + path + " is too long");
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    // Remove a socket left behind by an earlier server, but never any other kind of file
+    struct stat existing;
+    if (stat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+        unlink(path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error("Could not create socket: " + std::string(strerror(errno)));
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 64) != 0) {
+        std::string error = strerror(errno);
+        close(listen_fd);
+        throw std::runtime_error("Could not listen on " + path + ": " + error);
+    }
+
+    struct sigaction stop_action, old_int_action, old_term_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = request_stop;
+    sigemptyset(&stop_action.sa_mask);
+    stop_requested = 0;
+    sigaction(SIGINT, &stop_action, &old_int_action);
+    sigaction(SIGTERM, &stop_action, &old_term_action);
+
+    std::mutex clients_mutex;
+    std::condition_variable client_closed;
+    std::set<int> client_fds;
+    std::cerr << "Listening on " << path << "\n";
+
+    while (!stop_requested) {
+        // Wake up regularly to check for a stop request
+        pollfd listen_poll = {listen_fd, POLLIN, 0};
+        if (poll(&listen_poll, 1, 200) <= 0)
+            continue;
+        int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0)
+            continue;
+
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        client_fds.insert(client_fd);
+        std::thread([this, client_fd, &clients_mutex, &client_closed, &client_fds]() {
+            try {
+                serve_connection(client_fd, client_fd);
+            } catch (std::exception &e) {
+                std::cerr << "Closing connection after error: " << e.what() << "\n";
+            }
+            // Closed under the lock, so that a stop request never shuts down a reused descriptor
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            close(client_fd);
+            client_fds.erase(client_fd);
+            client_closed.notify_all();
+        }).detach();
+    }
+
+    // Stop reading from the clients, and give them some time to read the answers to the sentences already sent.
+    // Clients that do not read by then are cut off, which makes the writes to them fail.
+    std::unique_lock<std::mutex> lock(clients_mutex);
+    for (int client_fd : client_fds)
+        shutdown(client_fd, SHUT_RD);
+    if (!client_closed.wait_for(lock, std::chrono::seconds(5), [&client_fds]() { return client_fds.empty(); })) {
+        for (int client_fd : client_fds)
+            shutdown(client_fd, SHUT_RDWR);
+        client_closed.wait(lock, [&client_fds]() { return client_fds.empty(); });
+    }
+
+    close(listen_fd);
+    unlink(path.c_str());
+    sigaction(SIGINT, &old_int_action, nullptr);
+    sigaction(SIGTERM, &old_term_action, nullptr);
+}
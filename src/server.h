@@ -0,0 +1,121 @@
+#ifndef HANSTHOLM_SERVER_H
+#define HANSTHOLM_SERVER_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "learn.h"
+
+/**
+ * Collects request latencies and reports their distribution. Thread-safe. Latencies are counted in buckets
+ * whose bounds grow by a factor of 2^(1/8), so memory use does not grow with the number of requests and
+ * percentiles are accurate to within about 9%.
+ */
+class LatencyStats {
+public:
+    void record(double microseconds);
+    size_t count();
+    // The latency that `fraction` of the requests did not exceed, as the upper bound of its bucket
+    double percentile(double fraction);
+    // Writes the number of requests and the mean, median, 90th, 99th percentile and maximum latency
+    void report(std::ostream &out);
+private:
+    static const int buckets_per_doubling = 8;
+    // Bucket 0 holds latencies below 1 us, and the last bucket those above about 70 minutes
+    static const int num_buckets = 32 * buckets_per_doubling + 2;
+
+    double upper_bound(int bucket) const;
+    double percentile_locked(double fraction) const;
+
+    std::mutex mutex;
+    std::array<uint64_t, num_buckets> bucket_counts {};
+    size_t num_samples = 0;
+    double sum = 0;
+    double max = 0;
+};
+
+
+/**
+ * Parses sentences with a trained model for as long as clients keep sending them.
+ *
+ * Clients send sentences in the VW input format, each terminated by a blank line, and get back the lines of
+ * `output_parse_result` for each sentence, also terminated by a blank line. A sentence that cannot be read is
+ * answered with a single line starting with "# error:". Clients may send any number of sentences without waiting
+ * for answers. The sentences are parsed by a pool of worker threads, and the answers on each connection are
+ * written in the order the sentences were received. Each connection has its own writer thread, so a client that
+ * stops reading holds up only its own connection and never the workers.
+ *
+ * The dictionary should be frozen, so that reading sentences on several connections at once does not modify it.
+ */
+class ParseServer {
+public:
+    ParseServer(TransitionParser &parser, CorpusDictionary &dict, size_t num_workers,
+                size_t max_pending_per_connection = 1024);
+    ~ParseServer();
+    ParseServer(const ParseServer &) = delete;
+    ParseServer &operator=(const ParseServer &) = delete;
+
+    // Serves a single client that reads from `in_fd` and writes to `out_fd`, e.g. stdin and stdout.
+    // Returns when the input has ended and every answer is written.
+    void serve_connection(int in_fd, int out_fd);
+
+    // Accepts clients on a Unix domain socket until the process receives SIGINT or SIGTERM.
+    // Each client is read on its own thread. On a stop request, clients get a few seconds to read the answers
+    // to the sentences already sent, after which their connections are shut down. The socket file is removed
+    // on return.
+    void serve_unix_socket(const std::string &path);
+
+    LatencyStats latency_stats;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Connection {
+        int out_fd;
+        std::mutex mutex;
+        // Signals the writer that an answer was parsed or that the input has ended
+        std::condition_variable answer_ready;
+        // Signals the reader that an answer was written
+        std::condition_variable answer_written;
+        size_t num_received = 0;
+        size_t num_answered = 0;
+        bool input_ended = false;
+        // Parsed answers that are not written yet, with the time their sentence arrived
+        std::map<size_t, std::pair<std::string, clock::time_point>> waiting_answers;
+    };
+
+    struct Job {
+        Connection *connection;
+        size_t sequence_no;
+        Sentence sentence;
+        // Set if the sentence could not be read
+        std::string error;
+        clock::time_point received;
+    };
+
+    void worker_loop();
+    void answer(Job &job, std::string &&response);
+    // Writes the answers of `connection` in order until the input has ended and every sentence is answered
+    void write_answers(Connection &connection);
+
+    TransitionParser &parser;
+    CorpusDictionary &dict;
+    std::unordered_map<label_type_t, std::string> id_to_label;
+    size_t max_pending_per_connection;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_not_empty;
+    std::deque<Job> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+#endif //HANSTHOLM_SERVER_H
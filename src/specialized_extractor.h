@@ -0,0 +1,84 @@
+#ifndef HANSTHOLM_SPECIALIZED_EXTRACTOR_H
+#define HANSTHOLM_SPECIALIZED_EXTRACTOR_H
+
+#include <string>
+#include <vector>
+#include "feature_combiner.h"
+
+// Feature extraction steps shared by `FeatureProgram` and the extractors generated from a fixed template file at
+// build time (see `template_codegen.cc`). Sharing them keeps the features of both the same.
+
+
+// Combines each of the features from `start_index` on with every attribute in `it_pair`
+template <typename AttributeIterator>
+inline void add_attributes(std::vector<FeatureKey> &features, size_t start_index,
+                           std::pair<AttributeIterator, AttributeIterator> it_pair) {
+    size_t initial_vector_size = features.size();
+    assert(initial_vector_size - start_index >= 1);
+
+    if (it_pair.first != it_pair.second) {
+        // Loop over the existing features. We are guaranteed to have at least one feature.
+        for (size_t i = start_index; i < initial_vector_size; i++) {
+            // Skip the first attribute. We'll get back to it at the end of the loop.
+            auto it = std::next(it_pair.first);
+            for (; it != it_pair.second; it++) {
+                // Insert new features for the 1..n attributes in the namespace.
+                // These end up at indices beyond `initial_vector_size`, so we won't see them again in this loop.
+                features.push_back(features[i]);
+                features.back().add_attribute(*it);
+            }
+            // Now add the first attribute to the current feature.
+            features[i].add_attribute(*it_pair.first);
+        }
+    }
+}
+
+// Looks up the attributes of operand number `operand` of a program, whose location holds `token_index`,
+// and appends them prehashed to `scratch`. Operands must be looked up in order.
+inline void prehash_operand(FeatureProgramScratch &scratch, size_t operand, token_index_t token_index,
+                            const FeatureOperand &operand_info, const Sentence &sent) {
+    scratch.operand_begin[operand] = static_cast<uint32_t>(scratch.attributes.size());
+    assert(token_index >= -1 && token_index < static_cast<token_index_t>(sent.tokens.size()));
+    if (token_index >= 0) {
+        auto range = sent.find_namespace(token_index, operand_info.ns, operand_info.token_specific_ns);
+        for (auto attribute = range.first; attribute != range.second; attribute++)
+            scratch.attributes.push_back({prehash(static_cast<size_t>(attribute->index)), attribute->value});
+    }
+}
+
+inline void begin_operands(FeatureProgramScratch &scratch, size_t num_operands) {
+    scratch.attributes.clear();
+    scratch.operand_begin.resize(num_operands + 1);
+}
+
+inline void end_operands(FeatureProgramScratch &scratch, size_t num_operands) {
+    scratch.operand_begin[num_operands] = static_cast<uint32_t>(scratch.attributes.size());
+}
+
+// Combines the features from `start_index` on with the prehashed attributes of operand number `operand`
+inline void add_operand(std::vector<FeatureKey> &features, size_t start_index, const FeatureProgramScratch &scratch,
+                        size_t operand) {
+    const PrehashedAttribute *attributes = scratch.attributes.data();
+    add_attributes(features, start_index, std::make_pair(attributes + scratch.operand_begin[operand],
+                                                         attributes + scratch.operand_begin[operand + 1]));
+}
+
+
+// An extractor generated at build time. It is used for templates whose `UnionList::name` is `template_name`
+// and whose program has the same operand locations. Namespace ids are taken from the program's operands,
+// since they depend on the dictionary.
+struct SpecializedExtractor {
+    const char *template_name;
+    size_t num_operands;
+    const uint8_t *operand_locations;
+    specialized_fill_t fill;
+};
+
+// Makes an extractor available to templates parsed afterwards. Returns true, so that generated code can register
+// its extractor while initializing a static variable.
+bool register_specialized_extractor(const SpecializedExtractor *extractor);
+
+// The registered extractor for a template and its compiled program, or nullptr if there is none
+specialized_fill_t find_specialized_extractor(const std::string &template_name, const FeatureProgram &program);
+
+#endif //HANSTHOLM_SPECIALIZED_EXTRACTOR_H
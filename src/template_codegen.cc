@@ -0,0 +1,104 @@
+// Generates a feature extractor specialized for one template file (see specialized_extractor.h). The build runs
+// it when HANSTHOLM_SPECIALIZED_TEMPLATE is set and links the output into the parser.
+//
+// Usage: hanstholm_template_codegen TEMPLATE_FILE OUTPUT_FILE
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "feature_set_parser.h"
+
+
+// The template name as a C++ string literal
+std::string string_literal(const std::string &text) {
+    std::string literal = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': literal += "\\\""; break;
+            case '\\': literal += "\\\\"; break;
+            case '\n': literal += "\\n"; break;
+            default: literal += c;
+        }
+    }
+    return literal + "\"";
+}
+
+std::string generate(const UnionList &feature_set, const std::string &template_file) {
+    std::map<int, std::string> location_names;
+    for (auto &entry : state_location::name_to_id)
+        location_names[entry.second] = "state_location::" + entry.first;
+
+    const auto &program = feature_set.program;
+    std::ostringstream out;
+    out << "// Generated by hanstholm_template_codegen from " << template_file << ". Do not edit.\n\n"
+        << "#include \"specialized_extractor.h\"\n\n"
+        << "namespace {\n\n"
+        << "const size_t num_operands = " << program.operands.size() << ";\n\n"
+        << "void fill_features(const FeatureOperand *operands, const ParseState &state, const Sentence &sent,\n"
+        << "                   std::vector<FeatureKey> &features, FeatureProgramScratch &scratch) {\n"
+        << "    const auto &locations = state.locations_;\n\n"
+        << "    begin_operands(scratch, num_operands);\n";
+    for (size_t i = 0; i < program.operands.size(); i++) {
+        out << "    prehash_operand(scratch, " << i << ", locations[" << location_names[program.operands[i].location]
+            << "], operands[" << i << "], sent);\n";
+    }
+    out << "    end_operands(scratch, num_operands);\n";
+
+    auto template_name = feature_set.operands.begin();
+    for (size_t i = 0; i < program.instructions.size(); i += program.instructions[i].length + 1) {
+        auto &begin = program.instructions[i];
+        std::set<int> locations;
+        for (size_t j = i + 1; j <= i + begin.length; j++)
+            locations.insert(program.instructions[j].location);
+
+        out << "\n    // " << (*template_name++)->name << "\n    if (";
+        for (auto location = locations.begin(); location != locations.end(); location++)
+            out << (location != locations.begin() ? " && " : "") << "locations[" << location_names[*location]
+                << "] != -1";
+        out << ") {\n"
+            << "        size_t start_index = features.size();\n"
+            << "        features.push_back(FeatureKey(" << begin.feature_num << "));\n";
+        for (size_t j = i + 1; j <= i + begin.length; j++)
+            out << "        add_operand(features, start_index, scratch, " << program.instructions[j].operand << ");\n";
+        out << "    }\n";
+    }
+    out << "}\n\n";
+
+    out << "const uint8_t operand_locations[] = {";
+    for (size_t i = 0; i < program.operands.size(); i++)
+        out << (i > 0 ? ", " : "") << location_names[program.operands[i].location];
+    out << "};\n\n"
+        << "const SpecializedExtractor extractor = {\n"
+        << "        " << string_literal(feature_set.name) << ",\n"
+        << "        num_operands, operand_locations, fill_features};\n\n"
+        << "const bool registered = register_specialized_extractor(&extractor);\n\n"
+        << "}\n";
+    return out.str();
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " TEMPLATE_FILE OUTPUT_FILE\n";
+        return 1;
+    }
+
+    try {
+        CorpusDictionary dict;
+        auto feature_set = read_feature_file(argv[1], dict);
+        if (feature_set->program.operands.empty())
+            throw std::runtime_error("Template " + std::string(argv[1]) + " has no features");
+
+        std::ofstream out(argv[2]);
+        out << generate(*feature_set, argv[1]);
+        if (!out.good())
+            throw std::runtime_error("File " + std::string(argv[2]) + " cannot be written");
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
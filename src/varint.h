@@ -0,0 +1,38 @@
+#ifndef HANSTHOLM_VARINT_H
+#define HANSTHOLM_VARINT_H
+
+#include <string>
+#include <stdint.h>
+
+// LEB128 variable-length integers, as used by the binary cache files. Small values take a single byte.
+
+inline void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Decodes a varint at `pos` and moves `pos` past it. Returns false if the input ends within the varint.
+inline bool decode_varint(const char *&pos, const char *end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*pos++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Signed values are zigzag-encoded, so that small negative values are small as well
+inline uint64_t zigzag_encode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+#endif //HANSTHOLM_VARINT_H
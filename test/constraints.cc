@@ -2,6 +2,10 @@
 // Created by Anders Johannsen on 25/04/15.
 //
 
+#include <algorithm>
+#include <random>
+#include <sstream>
+
 #include "catch.h"
 
 #include "features.h"
@@ -87,3 +91,142 @@ TEST_CASE( "Constraints are honored" ) {
 
 }
 
+
+TEST_CASE( "indexed arc constraints disallow the same moves as checking every constraint" ) {
+    // A long sentence with many random arc constraints, parsed with random moves that ignore the constraints
+    const token_index_t num_tokens = 400;
+    std::mt19937 gen(3);
+    auto random_token = [&](token_index_t low) {
+        return std::uniform_int_distribution<token_index_t>(low, num_tokens - 1)(gen);
+    };
+    std::ostringstream text;
+    for (token_index_t i = 0; i < num_tokens; i++)
+        text << (i > 0 ? 0 : -1) << "-dep 'x|w x\n";
+    text << "#arc";
+    for (int i = 0; i < 300; i++)
+        text << " " << random_token(-1) << "-" << random_token(0);
+    text << "\n";
+
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(text.str());
+    Sentence sent;
+    REQUIRE(reader.read_sentence(in, sent));
+    REQUIRE(sent.arc_constraints.size() == 300);
+
+    // Checks every constraint against the whole stack
+    auto scan_constraints = [&](const ParseState &state, LabeledMoveSet &allowed_moves) {
+        const auto s0 = state.stack.empty() ? -1 : state.stack.back();
+        const auto n0 = state.n0;
+        auto in_stack = [&](token_index_t i) {
+            return std::find(state.stack.begin(), state.stack.end(), i) != state.stack.end();
+        };
+        for (const auto &ac : sent.arc_constraints) {
+            if ((ac.head == s0 && ac.dep >= n0) || (ac.dep == s0 && ac.head > n0))
+                allowed_moves.set(Move::LEFT_ARC, false);
+            if ((ac.head == n0 || ac.dep == n0) && !(ac.head == s0 && ac.dep == n0) &&
+                    (in_stack(ac.head) || in_stack(ac.dep)))
+                allowed_moves.set(Move::RIGHT_ARC, false);
+            if ((ac.head == s0 && ac.dep >= n0) || (ac.dep == s0 && ac.head >= n0))
+                allowed_moves.set(Move::REDUCE, false);
+            if ((ac.head == n0 || ac.dep == n0) && (in_stack(ac.head) || in_stack(ac.dep)))
+                allowed_moves.set(Move::SHIFT, false);
+        }
+    };
+
+    ArcEager unconstrained;
+    ConstrainedArcEager constrained;
+    auto moves = unconstrained.moves(dict.label_to_id.size());
+    auto state = ParseState(sent.tokens.size());
+    size_t num_mismatches = 0;
+    size_t num_constrained_states = 0;
+    while (!state.is_terminal()) {
+        auto allowed_moves = unconstrained.allowed_labeled_moves(state, sent);
+        auto expected_moves = allowed_moves;
+        scan_constraints(state, expected_moves);
+        auto actual_moves = constrained.allowed_labeled_moves(state, sent);
+        bool constrained_state = false;
+        for (auto move : {Move::SHIFT, Move::RIGHT_ARC, Move::LEFT_ARC, Move::REDUCE}) {
+            num_mismatches += actual_moves.test(move) != expected_moves.test(move);
+            constrained_state |= allowed_moves.test(move) != expected_moves.test(move);
+        }
+        num_constrained_states += constrained_state;
+
+        std::vector<LabeledMove> candidates;
+        for (auto &move : moves) {
+            if (allowed_moves.test(move))
+                candidates.push_back(move);
+        }
+        if (candidates.empty())
+            break;
+        perform_move(candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(gen)],
+                     state, sent.tokens);
+    }
+    REQUIRE(state.is_terminal());
+    REQUIRE(num_constrained_states > 0);
+    REQUIRE(num_mismatches == 0);
+}
+
+TEST_CASE( "span states keep count of the headless span nodes on the stack" ) {
+    // A long sentence with many nested spans, from splitting the sentence into halves at random points
+    const token_index_t num_tokens = 300;
+    std::mt19937 gen(4);
+    std::ostringstream text;
+    for (token_index_t i = 0; i < num_tokens; i++)
+        text << (i > 0 ? 0 : -1) << "-dep 'x|w x\n";
+    text << "#span";
+    std::vector<std::pair<token_index_t, token_index_t>> pending = {{1, num_tokens - 1}};
+    size_t num_spans = 0;
+    while (!pending.empty()) {
+        auto span = pending.back();
+        pending.pop_back();
+        if (span.second - span.first < 10)
+            continue;
+        text << " " << span.first << "-" << span.second;
+        num_spans++;
+        auto split = std::uniform_int_distribution<token_index_t>(span.first, span.second - 1)(gen);
+        pending.emplace_back(span.first, split);
+        pending.emplace_back(split + 1, span.second);
+    }
+    text << "\n";
+
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(text.str());
+    Sentence sent;
+    REQUIRE(reader.read_sentence(in, sent));
+    REQUIRE(sent.span_constraints.size() == num_spans);
+
+    // Random moves can leave a state with no allowed move, so several walks are made until they get stuck or finish
+    ConstrainedArcEager strategy;
+    auto moves = strategy.moves(dict.label_to_id.size());
+    size_t num_states = 0;
+    size_t num_mismatches = 0;
+    for (int walk = 0; walk < 50; walk++) {
+        auto state = ParseState(sent.tokens.size(), sent.span_constraints);
+        while (!state.is_terminal()) {
+            for (size_t i = 0; i < sent.span_constraints.size(); i++) {
+                const auto &sc = sent.span_constraints[i];
+                auto expected = std::count_if(state.stack.begin(), state.stack.end(), [&](token_index_t token) {
+                    return sc.is_inside(token) && state.heads[token] == -1;
+                });
+                num_mismatches += state.span_states[i].headless_nodes_in_stack != static_cast<size_t>(expected);
+            }
+            num_states++;
+
+            auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
+            std::vector<LabeledMove> candidates;
+            for (auto &move : moves) {
+                if (allowed_moves.test(move))
+                    candidates.push_back(move);
+            }
+            if (candidates.empty())
+                break;
+            auto move = candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(gen)];
+            update_span_states(move, state, sent);
+            perform_move(move, state, sent.tokens);
+        }
+    }
+    REQUIRE(num_states > 1000);
+    REQUIRE(num_mismatches == 0);
+}
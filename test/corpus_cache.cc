@@ -0,0 +1,126 @@
+#include "catch.h"
+
+#include <cstdio>
+#include <fstream>
+#include <utime.h>
+#include "corpus_cache.h"
+#include "input.h"
+
+
+static const char *example_corpus =
+        "#arc 1-0\n"
+        "#span 0-1\n"
+        "1-nsubj 'John|w John |p-1 NOUN:0.5\n"
+        "-1-root 'sleeps|w sleeps |  x:-2\n"
+        "\n"
+        "-1-root 'Hi|w Hi\n";
+
+static void write_file(const std::string &filename, const std::string &content) {
+    std::ofstream out(filename);
+    out << content;
+}
+
+static void require_same_sentences(const std::vector<Sentence> &expected, const std::vector<Sentence> &actual) {
+    REQUIRE(actual.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        REQUIRE(actual[i].tokens.size() == expected[i].tokens.size());
+        REQUIRE(actual[i].arc_constraints.size() == expected[i].arc_constraints.size());
+        REQUIRE(actual[i].span_constraints.size() == expected[i].span_constraints.size());
+        for (size_t j = 0; j < expected[i].tokens.size(); j++) {
+            auto &expected_token = expected[i].tokens[j];
+            auto &actual_token = actual[i].tokens[j];
+            REQUIRE(actual[i].token_id(j) == expected[i].token_id(j));
+            REQUIRE(actual_token.index == expected_token.index);
+            REQUIRE(actual_token.head == expected_token.head);
+            REQUIRE(actual_token.label == expected_token.label);
+            REQUIRE(actual_token.namespaces_begin == expected_token.namespaces_begin);
+            REQUIRE(actual_token.namespaces_end == expected_token.namespaces_end);
+        }
+        REQUIRE(actual[i].namespaces.size() == expected[i].namespaces.size());
+        for (size_t k = 0; k < expected[i].namespaces.size(); k++) {
+            auto &expected_ns = expected[i].namespaces[k];
+            auto &actual_ns = actual[i].namespaces[k];
+            REQUIRE(actual_ns.index == expected_ns.index);
+            REQUIRE(actual_ns.token_specific_ns == expected_ns.token_specific_ns);
+            REQUIRE(actual_ns.attributes_begin == expected_ns.attributes_begin);
+            REQUIRE(actual_ns.attributes_end == expected_ns.attributes_end);
+        }
+        REQUIRE(actual[i].attributes.size() == expected[i].attributes.size());
+        for (size_t l = 0; l < expected[i].attributes.size(); l++) {
+            REQUIRE(actual[i].attributes[l].index == expected[i].attributes[l].index);
+            REQUIRE(actual[i].attributes[l].value == expected[i].attributes[l].value);
+        }
+    }
+}
+
+TEST_CASE( "A cached corpus loads into the same sentences and ids as parsing" ) {
+    const std::string filename = "hanstholm_test_corpus.txt";
+    const std::string cache_file = filename + ".cache";
+    write_file(filename, example_corpus);
+    std::remove(cache_file.c_str());
+
+    // A dictionary that already has entries, as when reading the evaluation set after the training set
+    auto expected_dict = CorpusDictionary();
+    expected_dict.map_attribute("Hi");
+    expected_dict.map_label("root");
+    auto expected = VwSentenceReader(filename, expected_dict).read();
+
+    for (int run = 0; run < 2; run++) {
+        // The first run parses and writes the cache, and the second loads it
+        auto dict = CorpusDictionary();
+        dict.map_attribute("Hi");
+        dict.map_label("root");
+        auto sentences = read_with_corpus_cache(filename, cache_file, dict, 1);
+
+        require_same_sentences(expected, sentences);
+        REQUIRE(dict.label_to_id == expected_dict.label_to_id);
+        REQUIRE(dict.attribute_to_id == expected_dict.attribute_to_id);
+        REQUIRE(dict.namespace_to_id == expected_dict.namespace_to_id);
+        REQUIRE(sentences[0].span_constraints[0].span_end == 1);
+    }
+
+    std::remove(filename.c_str());
+    std::remove(cache_file.c_str());
+}
+
+TEST_CASE( "A corpus cache is stale once its source file changes" ) {
+    const std::string filename = "hanstholm_test_corpus.txt";
+    const std::string cache_file = filename + ".cache";
+    write_file(filename, example_corpus);
+    auto dict = CorpusDictionary();
+    auto sentences = VwSentenceReader(filename, dict).read();
+    write_corpus_cache(cache_file, filename, sentences, dict);
+
+    std::vector<Sentence> loaded;
+    auto loaded_dict = CorpusDictionary();
+    REQUIRE(read_corpus_cache(cache_file, filename, loaded, loaded_dict));
+
+    // Same size, different content
+    std::string changed = example_corpus;
+    changed.replace(changed.find("John"), 4, "Jane");
+    write_file(filename, changed);
+    // Make sure the modification time differs even on file systems with a coarse clock
+    utimbuf times = {1, 1};
+    utime(filename.c_str(), &times);
+    loaded.clear();
+    loaded_dict = CorpusDictionary();
+    REQUIRE(!read_corpus_cache(cache_file, filename, loaded, loaded_dict));
+
+    // Rewritten with the original content, only the modification time differs
+    write_file(filename, example_corpus);
+    REQUIRE(read_corpus_cache(cache_file, filename, loaded, loaded_dict));
+
+    // A truncated cache is reported
+    {
+        std::ifstream in(cache_file, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(cache_file, std::ios::binary | std::ios::trunc);
+        out << content.substr(0, content.size() - 3);
+    }
+    loaded.clear();
+    loaded_dict = CorpusDictionary();
+    REQUIRE_THROWS(read_corpus_cache(cache_file, filename, loaded, loaded_dict));
+
+    std::remove(filename.c_str());
+    std::remove(cache_file.c_str());
+}
@@ -0,0 +1,84 @@
+#include "catch.h"
+
+#include <cstdio>
+#include "feature_cache.h"
+
+
+static SentenceFeatureCache example_cache() {
+    SentenceFeatureCache cache;
+    FeatureKey feature;
+    for (size_t i = 0; i < 7; i++) {
+        feature.hashed_val = 0x9e3779b97f4a7c15ULL * (i + 1);
+        feature.value = (i == 3) ? 0.25f : 1.0f;
+        cache.features.push_back(feature);
+    }
+
+    LabeledMoveSet allowed;
+    allowed.allow_all();
+    LabeledMoveSet oracle;
+    oracle.set(LabeledMove(Move::LEFT_ARC, 5));
+    cache.transitions.push_back({4, allowed, oracle, 11});
+
+    LabeledMoveSet oracle_unlabeled;
+    oracle_unlabeled.set(Move::SHIFT);
+    cache.transitions.push_back({7, oracle_unlabeled, oracle_unlabeled, 0});
+    return cache;
+}
+
+static void require_same_cache(const SentenceFeatureCache &expected, const SentenceFeatureCache &actual) {
+    REQUIRE(actual.features.size() == expected.features.size());
+    for (size_t i = 0; i < expected.features.size(); i++) {
+        REQUIRE(actual.features[i].hashed_val == expected.features[i].hashed_val);
+        REQUIRE(actual.features[i].value == expected.features[i].value);
+    }
+
+    REQUIRE(actual.transitions.size() == expected.transitions.size());
+    for (size_t i = 0; i < expected.transitions.size(); i++) {
+        auto &a = actual.transitions[i];
+        auto &e = expected.transitions[i];
+        REQUIRE(a.features_end == e.features_end);
+        REQUIRE(a.gold_move_index == e.gold_move_index);
+        REQUIRE(a.allowed_moves.label == e.allowed_moves.label);
+        REQUIRE(a.oracle_moves.label == e.oracle_moves.label);
+        for (auto move : {Move::SHIFT, Move::REDUCE, Move::LEFT_ARC, Move::RIGHT_ARC}) {
+            REQUIRE(a.allowed_moves.test(move) == e.allowed_moves.test(move));
+            REQUIRE(a.oracle_moves.test(move) == e.oracle_moves.test(move));
+        }
+    }
+}
+
+TEST_CASE( "Sentence recordings survive encoding" ) {
+    auto cache = example_cache();
+    std::string record;
+    encode_sentence_cache(cache, record);
+
+    SentenceFeatureCache decoded;
+    decode_sentence_cache(record, decoded);
+    require_same_cache(cache, decoded);
+
+    record.resize(record.size() - 1);
+    REQUIRE_THROWS(decode_sentence_cache(record, decoded));
+}
+
+TEST_CASE( "Cache files are read back in order" ) {
+    auto cache = example_cache();
+    SentenceFeatureCache empty;
+    const std::string filename = "hanstholm_test_feature_cache.bin";
+    {
+        FeatureCacheWriter writer(filename);
+        writer.write(cache);
+        writer.write(empty);
+        writer.write(cache);
+    }
+
+    FeatureCacheReader reader(filename);
+    std::string record;
+    SentenceFeatureCache decoded;
+    for (auto expected : {&cache, &empty, &cache}) {
+        REQUIRE(reader.next(record));
+        decode_sentence_cache(record, decoded);
+        require_same_cache(*expected, decoded);
+    }
+    REQUIRE(!reader.next(record));
+    std::remove(filename.c_str());
+}
@@ -4,6 +4,12 @@
 
 #include "catch.h"
 
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+
 #include "features.h"
 #include "feature_set_parser.h"
 #include "input.h"
@@ -78,4 +84,481 @@ TEST_CASE( "arc and span constraints are read" ) {
 
 
 
-}
\ No newline at end of file
+}
+TEST_CASE( "sentences are read from a stream one at a time" ) {
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(
+            "1-nsubj '0-John|w John\n"
+            "-1-root '1-sleeps|w sleeps\n"
+            "\n"
+            "-1-root '0-Bad|w Bad\n"
+            "this line has no bar\n"
+            "0-dobj '2-more|w more\n"
+            "\n"
+            "-1-root '0-Hi|w Hi\n");
+
+    Sentence sentence;
+    REQUIRE(reader.read_sentence(in, sentence));
+    // The artificial root token is added at the end
+    REQUIRE(sentence.tokens.size() == 3);
+
+    // The malformed sentence is skipped in its entirety
+    bool malformed_reported = false;
+    try {
+        reader.read_sentence(in, sentence);
+    } catch (const input_parse_error &) {
+        malformed_reported = true;
+    }
+    REQUIRE(malformed_reported);
+
+    REQUIRE(reader.read_sentence(in, sentence));
+    REQUIRE(sentence.tokens.size() == 2);
+    REQUIRE(sentence.token_id(0) == "0-Hi");
+    REQUIRE(!reader.read_sentence(in, sentence));
+}
+
+TEST_CASE( "the input reader parses headers, namespaces, values and constraints" ) {
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(
+            "#arc 1-0 -1-2\n"
+            "#span 0-1\n"
+            "1-compound:prt 'it's|w it's |p-1 PRON:0.5 |  x\n"
+            "-1-root '1|w go:-2\n"
+            "\n"
+            "0-nsubj '0|w a:1.5e1\n"
+            "-1-root '1|w b:oops\n"
+            "\n"
+            "0-nsubj 'x|w ok\n"
+            "-1-root '1|w fine |q-z bad\n");
+
+    Sentence sentence;
+    REQUIRE(reader.read_sentence(in, sentence));
+    REQUIRE(sentence.arc_constraints.size() == 2);
+    REQUIRE(sentence.arc_constraints[1].head == -1);
+    REQUIRE(sentence.arc_constraints[1].dep == 2);
+    REQUIRE(sentence.span_constraints.size() == 1);
+    REQUIRE(sentence.span_constraints[0].span_end == 1);
+
+    auto &first = sentence.tokens[0];
+    REQUIRE(first.head == 1);
+    REQUIRE(first.label == dict.map_label("compound:prt"));
+    REQUIRE(sentence.token_id(0) == "it's");
+    REQUIRE(first.namespaces_end == first.namespaces_begin + 3);
+    auto &p_ns = sentence.namespaces[first.namespaces_begin + 1];
+    REQUIRE(p_ns.index == dict.map_namespace("p"));
+    REQUIRE(p_ns.token_specific_ns == 1);
+    REQUIRE(sentence.namespace_attributes(p_ns).first->index == dict.map_attribute("PRON"));
+    REQUIRE(sentence.namespace_attributes(p_ns).first->value == Approx(0.5));
+    REQUIRE(sentence.namespaces[first.namespaces_begin + 2].index == dict.map_namespace("*"));
+    auto default_attributes = sentence.find_namespace(0, dict.map_namespace("*"));
+    REQUIRE(default_attributes.second == default_attributes.first + 1);
+    REQUIRE(sentence.find_namespace(0, dict.map_namespace("p"), 1).first == sentence.namespace_attributes(p_ns).first);
+    auto missing = sentence.find_namespace(0, dict.map_namespace("p"), 2);
+    REQUIRE(missing.first == missing.second);
+    auto second_ns = sentence.namespaces[sentence.tokens[1].namespaces_begin];
+    REQUIRE(sentence.namespace_attributes(second_ns).first->value == Approx(-2));
+
+    // Values that are not numbers fall back to 1
+    REQUIRE(reader.read_sentence(in, sentence));
+    REQUIRE(sentence.attributes[sentence.namespaces[sentence.tokens[0].namespaces_begin].attributes_begin].value == Approx(15));
+    REQUIRE(sentence.attributes[sentence.namespaces[sentence.tokens[1].namespaces_begin].attributes_begin].value == Approx(1));
+
+    // Errors point at the line and column
+    try {
+        reader.read_sentence(in, sentence);
+        FAIL("Expected an input_parse_error");
+    } catch (input_parse_error &e) {
+        REQUIRE(e.line_no == 10);
+        REQUIRE(e.pos_on_line == 22);
+    }
+}
+
+TEST_CASE( "namespaces unknown to a frozen dictionary are left out of the namespace index" ) {
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(
+            "-1-root '0|w known |p VERB\n"
+            "\n"
+            "-1-root '0|zz foo |w known |p VERB\n"
+            "0-dep '1|yy bar\n");
+
+    Sentence sentence;
+    REQUIRE(reader.read_sentence(in, sentence));
+    dict.frozen = true;
+    REQUIRE(reader.read_sentence(in, sentence));
+    REQUIRE(sentence.namespaces[sentence.tokens[0].namespaces_begin].index == -1);
+
+    auto w = dict.map_namespace("w");
+    auto p = dict.map_namespace("p");
+    REQUIRE(sentence.namespace_table_width == static_cast<uint32_t>(std::max(w, p)) + 1);
+    REQUIRE(sentence.find_namespace(0, w).first->index == dict.map_attribute("known"));
+    REQUIRE(sentence.find_namespace(0, p).first->index == dict.map_attribute("VERB"));
+    auto none = sentence.find_namespace(1, w);
+    REQUIRE(none.first == none.second);
+    auto unknown = sentence.find_namespace(0, -1);
+    REQUIRE(unknown.first == unknown.second);
+}
+
+TEST_CASE( "files are read through a memory mapping" ) {
+    const std::string filename = "hanstholm_test_corpus.txt";
+    {
+        std::ofstream out(filename);
+        out << "#arc 1-0\n"
+               "1-nsubj 'first|w John\n"
+               "-1-root 'second|w sleeps\n"
+               "\n"
+               "-1-root 'last|w Hi";
+    }
+
+    auto dict = CorpusDictionary();
+    auto sentences = VwSentenceReader(filename, dict).read();
+    std::remove(filename.c_str());
+
+    // The identifiers stay readable after the reader is gone
+    REQUIRE(sentences.size() == 2);
+    REQUIRE(sentences[0].arc_constraints.size() == 1);
+    REQUIRE(sentences[0].token_id(0) == "first");
+    REQUIRE(sentences[0].token_id(1) == "second");
+    REQUIRE(sentences[0].tokens[1].head == 2);
+    REQUIRE(sentences[1].tokens.size() == 2);
+    REQUIRE(sentences[1].token_id(0) == "last");
+    REQUIRE(sentences[1].attributes[0].index == dict.map_attribute("Hi"));
+}
+
+TEST_CASE( "reading a file on several threads assigns the same ids as a sequential read" ) {
+    // Large enough to be split into several chunks
+    const std::string filename = "hanstholm_test_corpus.txt";
+    {
+        std::ofstream out(filename);
+        for (int i = 0; i < 40000; i++) {
+            out << "#arc 1-0\n";
+            out << "1-l" << (i * 7) % 13 << " 's" << i << "-0|w w" << (i * 31) % 5003 << " |p-1 p" << i % 17 << ":0.5\n";
+            out << "-1-root 's" << i << "-1|w w" << (i * 17) % 4999 << " |q q" << i % 23 << "\n\n";
+        }
+    }
+
+    auto sequential_dict = CorpusDictionary();
+    auto sequential = VwSentenceReader(filename, sequential_dict).read();
+    auto parallel_dict = CorpusDictionary();
+    parallel_dict.map_label("preset");
+    auto parallel = VwSentenceReader(filename, parallel_dict).read(4);
+    std::remove(filename.c_str());
+
+    REQUIRE(parallel.size() == sequential.size());
+    REQUIRE(parallel_dict.attribute_to_id == sequential_dict.attribute_to_id);
+    REQUIRE(parallel_dict.namespace_to_id == sequential_dict.namespace_to_id);
+    REQUIRE(parallel_dict.label_to_id.size() == sequential_dict.label_to_id.size() + 1);
+
+    auto same_sentence = [](const Sentence &expected, const Sentence &actual) {
+        if (actual.tokens.size() != expected.tokens.size() ||
+                actual.arc_constraints.size() != expected.arc_constraints.size())
+            return false;
+        for (size_t j = 0; j < expected.tokens.size(); j++) {
+            auto &expected_token = expected.tokens[j];
+            auto &actual_token = actual.tokens[j];
+            // Label ids are shifted by the label that was in the dictionary beforehand
+            if (actual.token_id(j) != expected.token_id(j) || actual_token.head != expected_token.head ||
+                    actual_token.label != expected_token.label + 1 ||
+                    actual_token.namespaces_begin != expected_token.namespaces_begin ||
+                    actual_token.namespaces_end != expected_token.namespaces_end)
+                return false;
+        }
+        if (actual.namespaces.size() != expected.namespaces.size() ||
+                actual.attributes.size() != expected.attributes.size())
+            return false;
+        for (size_t k = 0; k < expected.namespaces.size(); k++) {
+            auto &expected_ns = expected.namespaces[k];
+            auto &actual_ns = actual.namespaces[k];
+            if (actual_ns.index != expected_ns.index || actual_ns.token_specific_ns != expected_ns.token_specific_ns ||
+                    actual_ns.attributes_begin != expected_ns.attributes_begin ||
+                    actual_ns.attributes_end != expected_ns.attributes_end)
+                return false;
+        }
+        for (size_t l = 0; l < expected.attributes.size(); l++) {
+            if (actual.attributes[l].index != expected.attributes[l].index ||
+                    actual.attributes[l].value != expected.attributes[l].value)
+                return false;
+        }
+        return true;
+    };
+
+    size_t num_different = 0;
+    for (size_t i = 0; i < sequential.size(); i++)
+        num_different += !same_sentence(sequential[i], parallel[i]);
+    REQUIRE(num_different == 0);
+}
+
+TEST_CASE( "errors found on several threads report the line in the whole file" ) {
+    const std::string filename = "hanstholm_test_corpus.txt";
+    {
+        std::ofstream out(filename);
+        for (int i = 0; i < 60000; i++) {
+            if (i == 50000)
+                out << "no bar on this line\n";
+            out << "-1-root 's" << i << "|w w" << i << " |p padding-to-make-the-file-large-enough\n\n";
+        }
+    }
+
+    auto dict = CorpusDictionary();
+    size_t error_line = 0;
+    try {
+        VwSentenceReader(filename, dict).read(4);
+    } catch (input_parse_error &e) {
+        error_line = e.line_no;
+    }
+    std::remove(filename.c_str());
+    REQUIRE(error_line == 100001);
+}
+
+TEST_CASE( "a prefetching stream hands out the sentences of a file in order" ) {
+    const std::string filename = "hanstholm_test_corpus.txt";
+    {
+        std::ofstream out(filename);
+        for (int i = 0; i < 100; i++)
+            out << "-1-root 's" << i << "|w w" << i << "\n\n";
+        out << "no bar on this line\n";
+    }
+
+    auto dict = CorpusDictionary();
+    {
+        // A small queue, so the reader has to wait for the consumer
+        PrefetchingSentenceStream sentences(filename, dict, 3);
+        Sentence storage;
+        const Sentence *sentence;
+        size_t index;
+        for (size_t i = 0; i < 100; i++) {
+            REQUIRE(sentences.next(storage, sentence, index));
+            REQUIRE(index == i);
+            REQUIRE(sentence->token_id(0) == "s" + std::to_string(i));
+        }
+        bool error_reported = false;
+        try {
+            sentences.next(storage, sentence, index);
+        } catch (const input_parse_error &) {
+            error_reported = true;
+        }
+        REQUIRE(error_reported);
+    }
+    {
+        // Closing the stream early stops the reader
+        PrefetchingSentenceStream sentences(filename, dict, 3);
+    }
+    std::remove(filename.c_str());
+}
+
+TEST_CASE( "modifier locations are kept up to date on long sentences" ) {
+    // A sentence of several thousand tokens, parsed with random valid moves
+    const token_index_t num_tokens = 3000;
+    std::ostringstream text;
+    for (token_index_t i = 0; i < num_tokens; i++)
+        text << (i + 1 < num_tokens ? i + 1 : -1) << "-dep 'x|w x\n";
+
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(text.str());
+    Sentence sent;
+    REQUIRE(reader.read_sentence(in, sent));
+
+    // The dependents of `head` found by scanning all heads
+    auto scan = [](const ParseState &state, token_index_t head, bool from_left, size_t rank) {
+        size_t num_found = 0;
+        for (size_t j = 0; j < state.length; j++) {
+            token_index_t i = static_cast<token_index_t>(from_left ? j : state.length - 1 - j);
+            if ((from_left ? i < head : i > head) && state.heads[i] == head && ++num_found == rank)
+                return i;
+        }
+        return -1;
+    };
+
+    ArcEager strategy;
+    auto moves = strategy.moves(dict.label_to_id.size());
+    std::mt19937 gen(1);
+    auto state = ParseState(sent.tokens.size());
+    size_t num_mismatches = 0;
+    while (!state.is_terminal()) {
+        using namespace state_location;
+        auto &locations = state.locations_;
+        if (locations[S0] != -1) {
+            num_mismatches += locations[S0_left] != scan(state, locations[S0], true, 1);
+            num_mismatches += locations[S0_left2] != scan(state, locations[S0], true, 2);
+            num_mismatches += locations[S0_right] != scan(state, locations[S0], false, 1);
+            num_mismatches += locations[S0_right2] != scan(state, locations[S0], false, 2);
+        }
+        num_mismatches += locations[N0_left] != scan(state, locations[N0], true, 1);
+        num_mismatches += locations[N0_left2] != scan(state, locations[N0], true, 2);
+        num_mismatches += locations[N0_right] != scan(state, locations[N0], false, 1);
+
+        auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
+        std::vector<LabeledMove> candidates;
+        for (auto &move : moves) {
+            if (allowed_moves.test(move))
+                candidates.push_back(move);
+        }
+        if (candidates.empty())
+            break;
+        perform_move(candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(gen)],
+                     state, sent.tokens);
+    }
+    REQUIRE(state.is_terminal());
+    REQUIRE(num_mismatches == 0);
+}
+
+TEST_CASE( "the gold bookkeeping of a parse state agrees with scanning the stack and buffer" ) {
+    // A sentence with random gold heads, parsed with random valid moves
+    const token_index_t num_tokens = 500;
+    std::mt19937 gen(2);
+    std::ostringstream text;
+    for (token_index_t i = 0; i < num_tokens; i++) {
+        auto head = std::uniform_int_distribution<token_index_t>(-1, num_tokens - 2)(gen);
+        text << (head >= i ? head + 1 : head) << "-dep 'x|w x\n";
+    }
+
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(text.str());
+    Sentence sent;
+    REQUIRE(reader.read_sentence(in, sent));
+
+    auto head_in_stack = [&](const ParseState &state, token_index_t index) {
+        for (auto i : state.stack) {
+            if (sent.tokens[index].head == i)
+                return true;
+        }
+        return false;
+    };
+    auto dep_in_stack = [&](const ParseState &state, token_index_t index) {
+        for (auto i : state.stack) {
+            if (sent.tokens[i].head == index)
+                return true;
+        }
+        return false;
+    };
+    auto dep_in_buffer = [&](const ParseState &state, token_index_t index) {
+        for (auto i = state.n0; i < static_cast<token_index_t>(state.length); i++) {
+            if (sent.tokens[i].head == index)
+                return true;
+        }
+        return false;
+    };
+
+    ArcEager strategy;
+    auto moves = strategy.moves(dict.label_to_id.size());
+    auto state = ParseState(sent);
+    size_t num_mismatches = 0;
+    while (!state.is_terminal()) {
+        std::vector<token_index_t> indices = {state.n0};
+        if (!state.stack.empty())
+            indices.push_back(state.stack.back());
+        for (auto index : indices) {
+            num_mismatches += state.has_head_in_stack(index, sent) != head_in_stack(state, index);
+            num_mismatches += state.has_dep_in_stack(index, sent) != dep_in_stack(state, index);
+            num_mismatches += state.has_dep_in_buffer(index, sent) != dep_in_buffer(state, index);
+        }
+
+        auto allowed_moves = strategy.allowed_labeled_moves(state, sent);
+        std::vector<LabeledMove> candidates;
+        for (auto &move : moves) {
+            if (allowed_moves.test(move))
+                candidates.push_back(move);
+        }
+        if (candidates.empty())
+            break;
+        perform_move(candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(gen)],
+                     state, sent.tokens);
+    }
+    REQUIRE(state.is_terminal());
+    REQUIRE(num_mismatches == 0);
+}
+
+using fill_function = std::function<void(const ParseState &, const Sentence &, std::vector<FeatureKey> &)>;
+
+// Fills the features of every state along the gold transitions of a few sentences in two ways, and checks that
+// both give the same keys and values
+static void require_same_features_on_gold_states(CorpusDictionary &dict, fill_function expected, fill_function actual) {
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(
+            "1-det 'the|w the |p DET DEF:0.5\n"
+            "2-nsubj 'cat|w cat |p NOUN |x a b c\n"
+            "-1-root 'sat|w sat |p VERB:2\n"
+            "4-case 'on|w on |p ADP\n"
+            "2-obl 'mats|w mat mats:0.25 |p NOUN NUM:-1\n"
+            "2-punct '.|w . |x\n"
+            "\n"
+            "-1-root 'Go|p VERB\n"
+            "0-punct '!|w !\n");
+
+    ArcEager strategy;
+    auto moves = strategy.moves(dict.label_to_id.size() + 8);
+    size_t num_states = 0;
+    Sentence sent;
+    while (reader.read_sentence(in, sent)) {
+        auto state = ParseState(sent);
+        while (!state.is_terminal()) {
+            std::vector<FeatureKey> expected_features;
+            std::vector<FeatureKey> actual_features;
+            expected(state, sent, expected_features);
+            actual(state, sent, actual_features);
+
+            REQUIRE(actual_features.size() == expected_features.size());
+            bool same = true;
+            for (size_t i = 0; i < expected_features.size(); i++)
+                same = same && actual_features[i].hashed_val == expected_features[i].hashed_val &&
+                       actual_features[i].value == expected_features[i].value;
+            REQUIRE(same);
+            num_states++;
+
+            // Follow the gold transitions
+            auto oracle_moves = strategy.oracle(state, sent);
+            auto gold_move = std::find_if(moves.begin(), moves.end(),
+                                          [&](const LabeledMove &move) { return oracle_moves.test(move); });
+            REQUIRE(gold_move != moves.end());
+            perform_move(*gold_move, state, sent.tokens);
+        }
+    }
+    REQUIRE(num_states > 10);
+}
+
+TEST_CASE( "a compiled feature template gives the same features as the combiner tree" ) {
+    auto dict = CorpusDictionary();
+    auto feature_set = parse_feature_template(
+            "S0:w ++ S0:p\n"
+            "S0:w\n"
+            "N0:w ++ N0:p ++ N1:p  # comment\n"
+            "S0_head:p ++ S0:p ++ N0:p\n"
+            "S0_left:w ++ S0_right:p\n"
+            "S0_left2:p ++ S0_right2:p\n"
+            "N0_left:p ++ N0_left2:w ++ N0_right:p\n"
+            "N1:w ++ N2:w ++ N2:x\n", dict);
+    // No extractor is generated for this template
+    REQUIRE(feature_set->specialized == nullptr);
+
+    FeatureProgramScratch scratch;
+    require_same_features_on_gold_states(
+            dict,
+            [&](const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features) {
+                feature_set->fill_features(state, sent, features, 0);
+            },
+            [&](const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features) {
+                feature_set->program.fill_features(state, sent, features, scratch);
+            });
+}
+
+#ifdef HANSTHOLM_SPECIALIZED_TEMPLATE
+TEST_CASE( "the extractor generated for the specialized template gives the same features as its program" ) {
+    auto dict = CorpusDictionary();
+    auto feature_set = read_feature_file(HANSTHOLM_SPECIALIZED_TEMPLATE, dict);
+    REQUIRE(feature_set->specialized != nullptr);
+
+    FeatureProgramScratch scratch;
+    require_same_features_on_gold_states(
+            dict,
+            [&](const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features) {
+                feature_set->program.fill_features(state, sent, features, scratch);
+            },
+            [&](const ParseState &state, const Sentence &sent, std::vector<FeatureKey> &features) {
+                feature_set->extract(state, sent, features, scratch);
+            });
+}
+#endif
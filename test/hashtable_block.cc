@@ -0,0 +1,89 @@
+#include "catch.h"
+
+#include <mutex>
+#include <thread>
+#include "hashtable_block.h"
+#include "read_write_lock.h"
+
+
+TEST_CASE( "Hash table block lookup and insert" ) {
+    auto table = HashTableBlock(8, 4);
+
+    SECTION( "lookup of a missing key does not insert" ) {
+        REQUIRE(table.lookup(17) == nullptr);
+        REQUIRE(table.lookup(17) == nullptr);
+        REQUIRE(table.num_entries() == 0);
+    }
+
+    SECTION( "insert of an existing key returns the same block" ) {
+        auto *block = table.insert(17);
+        block[0] = 2.5;
+        REQUIRE(table.insert(17) == block);
+        REQUIRE(table.lookup(17) == block);
+        REQUIRE(table.num_entries() == 1);
+    }
+
+    SECTION( "values survive a resize" ) {
+        for (size_t key = 1; key <= 20; key++)
+            table.insert(key)[3] = key;
+
+        REQUIRE(table.num_cells() > 8);
+        REQUIRE(table.num_entries() == 20);
+        for (size_t key = 1; key <= 20; key++)
+            REQUIRE(table.lookup(key)[3] == key);
+    }
+}
+
+TEST_CASE( "Concurrent inserts grow the table without losing keys" ) {
+    auto table = HashTableBlock(8, 4);
+    ReadWriteLock resize_lock;
+    const size_t num_threads = 4;
+    const size_t num_keys = 5000;
+
+    // Every thread inserts all keys, so most inserts race with another thread inserting the same key
+    std::vector<std::thread> threads;
+    for (size_t thread_i = 0; thread_i < num_threads; thread_i++) {
+        threads.emplace_back([&, thread_i]() {
+            for (size_t key_i = 0; key_i < num_keys; key_i++) {
+                size_t key = (key_i + thread_i * 1237) % num_keys + 1;
+                SharedLockGuard guard(resize_lock);
+                while (table.insert_concurrent(key) == nullptr) {
+                    resize_lock.unlock_shared();
+                    {
+                        std::unique_lock<ReadWriteLock> exclusive(resize_lock);
+                        table.grow();
+                    }
+                    resize_lock.lock_shared();
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    REQUIRE(table.num_entries() == num_keys);
+    for (size_t key = 1; key <= num_keys; key++)
+        REQUIRE(table.lookup(key) != nullptr);
+}
+
+TEST_CASE( "Static hash table block holds the keys it was built from" ) {
+    std::vector<size_t> keys;
+    std::vector<float> values;
+    for (size_t key = 1; key <= 100; key++) {
+        keys.push_back(key * 7919);
+        values.push_back(key);
+        values.push_back(-static_cast<float>(key));
+    }
+
+    auto table = StaticHashTableBlock(keys, values, 2);
+    REQUIRE(table.num_entries() == 100);
+
+    for (size_t key = 1; key <= 100; key++) {
+        auto *block = table.lookup(key * 7919);
+        REQUIRE(block != nullptr);
+        REQUIRE(block[0] == key);
+        REQUIRE(block[1] == -static_cast<float>(key));
+    }
+
+    REQUIRE(table.lookup(3) == nullptr);
+}
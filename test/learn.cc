@@ -0,0 +1,313 @@
+#include "catch.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "feature_set_parser.h"
+#include "input.h"
+#include "learn.h"
+#include "model_file.h"
+#include "test_corpus.h"
+
+
+// An optional subject and up to three objects around a verb. Determiners and adjectives attach to their noun,
+// and nouns to the verb. These trees are learnt almost perfectly from the parts of speech of S0 and N0.
+static std::string example_treebank(size_t num_sentences) {
+    std::ostringstream text;
+    unsigned state = 12345;
+    auto next_random = [&state](unsigned range) {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) % range;
+    };
+    struct Word { int head; const char *label; std::string form; const char *tag; };
+    for (size_t sent_i = 0; sent_i < num_sentences; sent_i++) {
+        std::vector<Word> words;
+        bool has_subject = next_random(2);
+        int num_phrases = has_subject + 1 + next_random(3);
+        int verb = -1;
+        for (int phrase = 0; phrase < num_phrases; phrase++) {
+            if (verb == -1 && (phrase == 1 || !has_subject)) {
+                verb = words.size();
+                words.push_back({-1, "root", "v" + std::to_string(next_random(5)), "VERB"});
+            }
+            bool has_det = next_random(2);
+            bool has_adj = next_random(2);
+            int noun = words.size() + has_det + has_adj;
+            if (has_det)
+                words.push_back({noun, "det", "d" + std::to_string(next_random(3)), "DET"});
+            if (has_adj)
+                words.push_back({noun, "amod", "a" + std::to_string(next_random(5)), "ADJ"});
+            words.push_back({verb, verb == -1 ? "nsubj" : "obj", "n" + std::to_string(next_random(10)), "NOUN"});
+        }
+        // The subject was placed before its verb existed
+        if (has_subject)
+            words[verb - 1].head = verb;
+
+        for (auto &word : words)
+            text << word.head << "-" << word.label << " '" << word.form << "|w " << word.form << " |p " << word.tag << "\n";
+        text << "\n";
+    }
+    return text.str();
+}
+
+static std::string read_file(const std::string &filename) {
+    std::ifstream in(filename, std::ifstream::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void require_same_parses(const ParseResult &expected, const ParseResult &actual) {
+    REQUIRE(actual.heads == expected.heads);
+    REQUIRE(actual.labels == expected.labels);
+}
+
+
+TEST_CASE( "parsing with warm scratch buffers allocates only the result" ) {
+    if (!heap_allocations_counted())
+        return;
+
+    std::ostringstream text;
+    text << "1-det 'the|w the |p DET\n"
+            "2-nsubj 'cat|w cat |p NOUN\n"
+            "-1-root 'sat|w sat |p VERB\n"
+            "\n";
+    const int long_length = 300;
+    for (int i = 0; i < long_length; i++)
+        text << (i + 1 < long_length ? i + 1 : -1) << "-dep 'w" << i << "|w w" << i << " |p X\n";
+
+    auto dict = CorpusDictionary();
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(text.str());
+    Sentence short_sent, long_sent;
+    REQUIRE(reader.read_sentence(in, short_sent));
+    REQUIRE(reader.read_sentence(in, long_sent));
+
+    auto feature_builder = parse_feature_template(example_template, dict);
+    ArcEager strategy;
+    TransitionParser parser(dict, feature_builder, strategy);
+
+    // The first parse of the longest sentence sizes the buffers
+    parser.parse(long_sent);
+
+    // Only the heads and labels of the result are allocated, however many transitions the sentence takes
+    for (auto *sent : {&short_sent, &long_sent}) {
+        size_t allocations_before = heap_allocation_count();
+        auto result = parser.parse(*sent);
+        size_t num_allocations = heap_allocation_count() - allocations_before;
+        REQUIRE(result.heads.size() == sent->tokens.size());
+        REQUIRE(num_allocations == 2);
+    }
+}
+
+TEST_CASE( "weights are averaged exactly past 2^24 updates" ) {
+    // Changes to three weights of a section, numbered beyond what a float counts exactly.
+    // The section size is even, like that of every section, so the doubles after the weights are aligned.
+    const size_t num_elems = 4;
+    std::vector<float> block(num_elems * WeightSectionWrap::num_blocks, 0);
+    WeightSectionWrap section(block.data(), num_elems);
+    const size_t first_update = size_t(1) << 26;
+    const size_t num_updates = first_update + 1000;
+
+    struct Change {
+        size_t weight;
+        float value;
+        size_t update_number;
+    };
+    std::vector<Change> changes = {
+            // Weight 0 is 1 for a single update
+            {0, 1, first_update}, {0, -1, first_update + 1},
+            // Weight 1 is 0.5 for 10 updates, then 0.25 until the end
+            {1, 0.5f, first_update + 10}, {1, -0.25f, first_update + 20},
+            // Weight 2 changes at the first and the last update
+            {2, 2, 1}, {2, -3, num_updates},
+    };
+    for (auto &change : changes)
+        section.add(change.weight, change.value, change.update_number);
+
+    // The weight after update t holds for updates t..num_updates. Compare the sums over all updates,
+    // since some averages are tiny.
+    std::vector<double> expected_sums(num_elems, 0);
+    for (auto &change : changes)
+        expected_sums[change.weight] += change.value * static_cast<double>(num_updates - change.update_number + 1);
+    for (size_t i = 0; i < num_elems; i++) {
+        double sum = static_cast<double>(section.average(i, num_updates)) * num_updates;
+        REQUIRE(sum == Approx(expected_sums[i]).epsilon(1e-6));
+    }
+}
+
+TEST_CASE( "a saved model parses like the parser that saved it" ) {
+    const std::string filename = "hanstholm_test_model.bin";
+    auto dict = CorpusDictionary();
+    auto train_sents = read_sentences(example_treebank(50), dict);
+    auto feature_builder = parse_feature_template(example_template, dict);
+    ArcEager strategy;
+    TransitionParser parser(dict, feature_builder, strategy, 2);
+    parser.fit(train_sents);
+    parser.save(filename);
+
+    auto loaded_dict = CorpusDictionary();
+    std::string template_text;
+    size_t num_trained_moves;
+    auto weights = read_model_file(filename, loaded_dict, template_text, num_trained_moves);
+    REQUIRE(template_text == example_template);
+    REQUIRE(loaded_dict.label_to_id == dict.label_to_id);
+    REQUIRE(loaded_dict.namespace_to_id == dict.namespace_to_id);
+    REQUIRE(loaded_dict.attribute_to_id == dict.attribute_to_id);
+
+    auto loaded_feature_builder = parse_feature_template(template_text, loaded_dict);
+    loaded_dict.frozen = true;
+    TransitionParser loaded_parser(loaded_dict, loaded_feature_builder, strategy, std::move(weights), num_trained_moves);
+
+    auto test_text = example_treebank(80);
+    dict.frozen = true;
+    auto test_sents = read_sentences(test_text, dict);
+    auto loaded_test_sents = read_sentences(test_text, loaded_dict);
+    REQUIRE(loaded_test_sents.size() == test_sents.size());
+    ParseScore score {};
+    for (size_t i = 0; i < test_sents.size(); i++) {
+        auto result = loaded_parser.parse(loaded_test_sents[i]);
+        require_same_parses(parser.parse(test_sents[i]), result);
+        loaded_test_sents[i].score(result, score);
+    }
+    // The treebank is easy to learn, so the parses compared are not just the untrained defaults
+    REQUIRE(score.uas() > 0.95);
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE( "training with a feature cache gives the same model as training without" ) {
+    auto dict = CorpusDictionary();
+    auto train_sents = read_sentences(example_treebank(100), dict);
+    auto test_sents = read_sentences(example_treebank(150), dict);
+    ArcEager strategy;
+
+    struct Setting {
+        bool use_feature_cache;
+        std::string feature_cache_file;
+        std::string model_file;
+    };
+    std::vector<Setting> settings = {
+            {false, "", "hanstholm_test_model.bin"},
+            {true, "", "hanstholm_test_model_cached.bin"},
+            {true, "hanstholm_test_feature_cache.bin", "hanstholm_test_model_cache_file.bin"},
+    };
+
+    std::vector<std::vector<ParseResult>> parses;
+    for (auto &setting : settings) {
+        auto feature_builder = parse_feature_template(example_template, dict);
+        TransitionParser parser(dict, feature_builder, strategy, 4);
+        parser.use_feature_cache = setting.use_feature_cache;
+        parser.feature_cache_file = setting.feature_cache_file;
+
+        std::ostringstream training_log;
+        auto *cout_buffer = std::cout.rdbuf(training_log.rdbuf());
+        parser.fit(train_sents);
+        std::cout.rdbuf(cout_buffer);
+
+        if (setting.use_feature_cache) {
+            // Some recordings stop being replayed where the gold move changes with the weights
+            std::istringstream log_lines(training_log.str());
+            bool diverged = false;
+            for (std::string line; std::getline(log_lines, line); ) {
+                size_t num_replayed, num_transitions;
+                if (std::sscanf(line.c_str(), "%zu of %zu transitions replayed", &num_replayed, &num_transitions) == 2)
+                    diverged |= num_replayed > 0 && num_replayed < num_transitions;
+            }
+            REQUIRE(diverged);
+        }
+
+        parser.save(setting.model_file);
+        parses.emplace_back();
+        for (auto &sent : test_sents)
+            parses.back().push_back(parser.parse(sent));
+    }
+
+    for (size_t i = 1; i < settings.size(); i++) {
+        REQUIRE(read_file(settings[i].model_file) == read_file(settings[0].model_file));
+        for (size_t sent_i = 0; sent_i < test_sents.size(); sent_i++)
+            require_same_parses(parses[0][sent_i], parses[i][sent_i]);
+    }
+    for (auto &setting : settings)
+        std::remove(setting.model_file.c_str());
+}
+
+TEST_CASE( "parsing a batch on several threads gives the same parses and score as parsing one at a time" ) {
+    auto dict = CorpusDictionary();
+    auto train_sents = read_sentences(example_treebank(50), dict);
+    auto test_sents = read_sentences(example_treebank(500), dict);
+    auto feature_builder = parse_feature_template(example_template, dict);
+    ArcEager strategy;
+    TransitionParser parser(dict, feature_builder, strategy, 2);
+    parser.fit(train_sents);
+
+    std::vector<ParseResult> expected;
+    ParseScore expected_score {};
+    for (auto &sent : test_sents) {
+        expected.push_back(parser.parse(sent));
+        sent.score(expected.back(), expected_score);
+    }
+
+    for (size_t num_threads : {1, 3, 8}) {
+        std::vector<ParseResult> results(test_sents.size());
+        // The totals are added to the score passed in
+        ParseScore score {};
+        score.num_total = 1;
+        parser.parse_batch(test_sents.data(), test_sents.size(), results.data(), num_threads, &score);
+
+        for (size_t i = 0; i < test_sents.size(); i++)
+            require_same_parses(expected[i], results[i]);
+        REQUIRE(score.num_correct_unlabeled == expected_score.num_correct_unlabeled);
+        REQUIRE(score.num_correct_labeled == expected_score.num_correct_labeled);
+        REQUIRE(score.num_total == expected_score.num_total + 1);
+    }
+}
+
+// Hands out the sentences of a vector for one pass, like the stream `fit` makes for a vector internally
+class SentenceVectorStream : public SentenceStream {
+public:
+    SentenceVectorStream(const std::vector<Sentence> &sentences) : sentences(sentences) { }
+
+    bool next(Sentence &, const Sentence *&sentence, size_t &index) override {
+        if (next_index >= sentences.size())
+            return false;
+        index = next_index++;
+        sentence = &sentences[index];
+        return true;
+    }
+
+private:
+    const std::vector<Sentence> &sentences;
+    size_t next_index = 0;
+};
+
+TEST_CASE( "training passes with warm scratch buffers do not allocate" ) {
+    if (!heap_allocations_counted())
+        return;
+
+    auto dict = CorpusDictionary();
+    auto train_sents = read_sentences(example_treebank(50), dict);
+    auto feature_builder = parse_feature_template(example_template, dict);
+    ArcEager strategy;
+    const int num_passes = 4;
+    TransitionParser parser(dict, feature_builder, strategy, num_passes);
+
+    // The weight table starts out far larger than the features of these sentences need, so it never grows.
+    // After the first pass has sized the scratch buffers, a pass only allocates its sentence stream.
+    // The allocation count is noted each time `fit` asks for the stream of a new pass.
+    std::vector<size_t> allocations_at_pass_start;
+    allocations_at_pass_start.reserve(num_passes);
+    parser.fit(train_sents.size(), [&]() {
+        allocations_at_pass_start.push_back(heap_allocation_count());
+        return std::unique_ptr<SentenceStream>(new SentenceVectorStream(train_sents));
+    });
+
+    REQUIRE(allocations_at_pass_start.size() == num_passes);
+    for (int pass = 1; pass + 1 < num_passes; pass++) {
+        size_t num_allocations = allocations_at_pass_start[pass + 1] - allocations_at_pass_start[pass];
+        REQUIRE(num_allocations == 1);
+    }
+}
@@ -0,0 +1,32 @@
+#include "catch.h"
+
+#include "score_kernel.h"
+#include "aligned_allocator.h"
+
+
+TEST_CASE( "Score kernels agree with the scalar kernel" ) {
+    const size_t num_elems = padded_row_size(83);
+    REQUIRE((num_elems % score_vector_width) == 0);
+    REQUIRE(num_elems >= 83);
+
+    aligned_vector<float> row(num_elems);
+    for (size_t i = 0; i < num_elems; i++)
+        row[i] = 0.1f * i - 3;
+
+    auto scalar = accumulate_row_kernel("scalar");
+    REQUIRE(scalar != nullptr);
+
+    for (auto name : {"sse", "avx2"}) {
+        auto kernel = accumulate_row_kernel(name);
+        if (kernel == nullptr)
+            continue;
+
+        for (float value : {1.0f, 0.7f}) {
+            aligned_vector<float> expected(num_elems, 1);
+            aligned_vector<float> actual(num_elems, 1);
+            scalar(expected.data(), row.data(), num_elems, value);
+            kernel(actual.data(), row.data(), num_elems, value);
+            REQUIRE(expected == actual);
+        }
+    }
+}
@@ -0,0 +1,219 @@
+#include "catch.h"
+
+#include <chrono>
+#include <cmath>
+#include <fcntl.h>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "feature_set_parser.h"
+#include "input.h"
+#include "output.h"
+#include "server.h"
+#include "test_corpus.h"
+
+
+// Chains of words where each word attaches to the next, and the last one is the root
+static std::string chain_sentence(const std::string &prefix, int length, int first_word) {
+    std::ostringstream text;
+    for (int i = 0; i < length; i++) {
+        int word = (first_word + i) % 10;
+        text << (i + 1 < length ? i + 1 : -1) << "-" << (i + 1 < length ? "dep" : "root")
+             << " '" << prefix << i << "|w w" << word << " |p P" << word % 3 << "\n";
+    }
+    text << "\n";
+    return text.str();
+}
+
+static std::string chain_treebank(int num_sentences) {
+    std::string text;
+    for (int i = 0; i < num_sentences; i++)
+        text += chain_sentence("t" + std::to_string(i) + "-", 2 + i % 5, i);
+    return text;
+}
+
+// The answer the server should give to the sentence in `request`, from parsing it directly
+static std::string expected_answer(TransitionParser &parser, CorpusDictionary &dict, const std::string &request) {
+    auto id_to_label = invert_map(dict.label_to_id);
+    auto sentences = read_sentences(request, dict);
+    REQUIRE(sentences.size() == 1);
+    std::ostringstream answer;
+    output_parse_result(answer, sentences[0], parser.parse(sentences[0]), id_to_label);
+    answer << "\n";
+    return answer.str();
+}
+
+static std::string read_all(int fd) {
+    std::string data;
+    char buffer[4096];
+    ssize_t num_read;
+    while ((num_read = read(fd, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, num_read);
+    return data;
+}
+
+TEST_CASE( "a server connection answers pipelined sentences in order" ) {
+    auto dict = CorpusDictionary();
+    auto train_sents = read_sentences(chain_treebank(30), dict);
+
+    auto feature_builder = parse_feature_template(example_template, dict);
+    ConstrainedArcEager strategy;
+    TransitionParser parser(dict, feature_builder, strategy, 2);
+    parser.fit(train_sents);
+    dict.frozen = true;
+
+    // Sentences of uneven length, so that the workers finish them out of order. Some have words, labels and
+    // namespaces the model has never seen, and one cannot be read at all.
+    const int num_requests = 60;
+    const int malformed_request = 25;
+    std::vector<std::string> requests;
+    for (int i = 0; i < num_requests; i++) {
+        std::string prefix = "s" + std::to_string(i) + "-";
+        if (i == malformed_request)
+            requests.push_back("-1-root '" + prefix + "0|w w1\nthis line has no bar\n\n");
+        else if (i % 10 == 3)
+            requests.push_back("1-unseen '" + prefix + "0|w unknown" + std::to_string(i) + " |p P0\n"
+                               "-1-root '" + prefix + "1|w w2 |zz foo |p P2\n\n");
+        else
+            requests.push_back(chain_sentence(prefix, 1 + (i * 7) % 13, i));
+    }
+
+    std::vector<std::string> expected_answers;
+    for (int i = 0; i < num_requests; i++)
+        expected_answers.push_back(i == malformed_request ? "" : expected_answer(parser, dict, requests[i]));
+
+    int to_server[2], from_server[2];
+    REQUIRE(pipe(to_server) == 0);
+    REQUIRE(pipe(from_server) == 0);
+    {
+        // Only a few sentences may wait for their answers, so reading also has to wait for the workers
+        ParseServer server(parser, dict, 3, 4);
+        std::thread serving([&]() {
+            server.serve_connection(to_server[0], from_server[1]);
+            close(from_server[1]);
+        });
+        bool all_sent = true;
+        std::thread sending([&]() {
+            for (auto &request : requests)
+                all_sent &= write(to_server[1], request.data(), request.size()) == static_cast<ssize_t>(request.size());
+            close(to_server[1]);
+        });
+        std::string output = read_all(from_server[0]);
+        sending.join();
+        serving.join();
+        close(to_server[0]);
+        close(from_server[0]);
+        REQUIRE(all_sent);
+
+        // Every answer ends with a blank line
+        std::vector<std::string> answers;
+        size_t answer_begin = 0;
+        for (size_t blank_line; (blank_line = output.find("\n\n", answer_begin)) != std::string::npos; ) {
+            answers.push_back(output.substr(answer_begin, blank_line + 2 - answer_begin));
+            answer_begin = blank_line + 2;
+        }
+        REQUIRE(answer_begin == output.size());
+        REQUIRE(answers.size() == requests.size());
+        for (int i = 0; i < num_requests; i++) {
+            if (i == malformed_request)
+                REQUIRE(answers[i].compare(0, 9, "# error: ") == 0);
+            else
+                REQUIRE(answers[i] == expected_answers[i]);
+        }
+        REQUIRE(server.latency_stats.count() == requests.size());
+    }
+}
+
+TEST_CASE( "a client that does not read its answers holds up only its own connection" ) {
+    auto dict = CorpusDictionary();
+    auto train_sents = read_sentences(chain_treebank(30), dict);
+    auto feature_builder = parse_feature_template(example_template, dict);
+    ConstrainedArcEager strategy;
+    TransitionParser parser(dict, feature_builder, strategy, 2);
+    parser.fit(train_sents);
+    dict.frozen = true;
+
+    int stuck_in[2], stuck_out[2], other_in[2], other_out[2];
+    REQUIRE(pipe(stuck_in) == 0);
+    REQUIRE(pipe(stuck_out) == 0);
+    REQUIRE(pipe(other_in) == 0);
+    REQUIRE(pipe(other_out) == 0);
+    int stuck_out_size = fcntl(stuck_out[1], F_SETPIPE_SZ, 4096);
+    REQUIRE(stuck_out_size > 0);
+
+    // A single worker, which used to block while writing to a client that had stopped reading
+    ParseServer server(parser, dict, 1, 4);
+    std::thread stuck_serving([&]() {
+        server.serve_connection(stuck_in[0], stuck_out[1]);
+        close(stuck_out[1]);
+    });
+    std::thread stuck_sending([&]() {
+        std::string requests;
+        for (int i = 0; i < 300; i++)
+            requests += chain_sentence("s" + std::to_string(i) + "-", 6, i);
+        write(stuck_in[1], requests.data(), requests.size());
+        close(stuck_in[1]);
+    });
+
+    // Wait until the answers have nearly filled the pipe of the client that does not read.
+    // An answer is about 120 bytes, so a few more fit at most.
+    for (int num_buffered = 0; stuck_out_size - num_buffered >= 512; ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        REQUIRE(ioctl(stuck_out[0], FIONREAD, &num_buffered) == 0);
+    }
+
+    std::string other_requests[] = {chain_sentence("a-", 3, 1), chain_sentence("b-", 4, 2)};
+    auto other_client = std::async(std::launch::async, [&]() {
+        std::thread serving([&]() {
+            server.serve_connection(other_in[0], other_out[1]);
+            close(other_out[1]);
+        });
+        std::string requests = other_requests[0] + other_requests[1];
+        write(other_in[1], requests.data(), requests.size());
+        close(other_in[1]);
+        std::string output = read_all(other_out[0]);
+        serving.join();
+        return output;
+    });
+    bool other_answered = other_client.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+
+    // Closing the reading end makes the writes to the stuck client fail, which ends its connection
+    close(stuck_out[0]);
+    stuck_sending.join();
+    stuck_serving.join();
+    auto other_output = other_client.get();
+    for (int fd : {stuck_in[0], other_in[0], other_out[0]})
+        close(fd);
+
+    REQUIRE(other_answered);
+    REQUIRE(other_output == expected_answer(parser, dict, other_requests[0]) +
+                            expected_answer(parser, dict, other_requests[1]));
+}
+
+TEST_CASE( "latency percentiles come from log-spaced buckets" ) {
+    LatencyStats stats;
+    REQUIRE(stats.percentile(0.5) == 0);
+    for (int latency = 1; latency <= 1000; latency++)
+        stats.record(latency);
+    stats.record(0.25);
+
+    REQUIRE(stats.count() == 1001);
+    // Bucket bounds are 2^(1/8) apart, so the reported bound is at most 9% above the exact percentile.
+    // The sample of rank r in sorted order has latency r.
+    for (double fraction : {0.5, 0.9, 0.99}) {
+        double exact = std::floor(fraction * 1001);
+        REQUIRE(stats.percentile(fraction) >= exact);
+        REQUIRE(stats.percentile(fraction) <= exact * 1.091);
+    }
+    REQUIRE(stats.percentile(0) <= 1);
+    REQUIRE(stats.percentile(1) == 1000);
+
+    std::ostringstream report;
+    stats.report(report);
+    std::string expected_start = "Served 1001 sentences\nLatency (us): mean ";
+    REQUIRE(report.str().compare(0, expected_start.size(), expected_start) == 0);
+}
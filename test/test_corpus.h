@@ -0,0 +1,24 @@
+#ifndef HANSTHOLM_TEST_CORPUS_H
+#define HANSTHOLM_TEST_CORPUS_H
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "input.h"
+
+// Feature template for the parsers trained in the tests. It is small, so training takes little time.
+const char *const example_template = "S0:w\nN0:w\nS0:p ++ N0:p\nN0:w ++ N1:p\n";
+
+// Reads every sentence of `text`, which is in the VW input format
+inline std::vector<Sentence> read_sentences(const std::string &text, CorpusDictionary &dict) {
+    auto reader = VwSentenceReader("<stream>", dict);
+    std::istringstream in(text);
+    std::vector<Sentence> sentences(1);
+    while (reader.read_sentence(in, sentences.back()))
+        sentences.emplace_back();
+    sentences.pop_back();
+    return sentences;
+}
+
+#endif //HANSTHOLM_TEST_CORPUS_H